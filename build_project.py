@@ -31,10 +31,10 @@ os.chdir( ".." )
 #specify the search paths/dependencies/options for gcc
 include_paths = [ "../include" ]
 link_paths = [ "../lib" ]
-link_dependencies = [ "-lSaleaeDevice" ] #refers to libSaleaeDevice.dylib
+link_dependencies = [ "-lSaleaeDevice", "-pthread" ] #refers to libSaleaeDevice.dylib
 
-debug_compile_flags = "-m32 -O0 -w -c -fpic -g"
-release_compile_flags = "-m32 -O3 -w -c -fpic"
+debug_compile_flags = "-m32 -msse2 -D_FILE_OFFSET_BITS=64 -D_LARGEFILE_SOURCE -std=c++11 -pthread -O0 -w -c -fpic -g"
+release_compile_flags = "-m32 -msse2 -D_FILE_OFFSET_BITS=64 -D_LARGEFILE_SOURCE -std=c++11 -pthread -O3 -w -c -fpic"
 
 #loop through all the cpp files, build up the gcc command line, and attempt to compile each cpp file
 for cpp_file in cpp_files:
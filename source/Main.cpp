@@ -9,6 +9,7 @@
 #include <string>
 #include <cstring>
 #include <memory>
+#include <vector>
 #include <iostream>
 #include <SaleaeDeviceApi.h>
 #if defined(WIN32)
@@ -18,23 +19,31 @@
 #endif
 #include "voltmeter.hpp"
 #include "wavfile.hpp"
-
-void __stdcall OnConnect(U64 device_id, GenericInterface* device_interface,
-			 void* user_data );
-void __stdcall OnDisconnect(U64 device_id, void* user_data );
-void __stdcall OnReadData(U64 device_id, U8* data, U32 data_length,
-			  void* user_data );
-void __stdcall OnWriteData(U64 device_id, U8* data, U32 data_length,
-			   void* user_data );
-void __stdcall OnError( U64 device_id, void* user_data );
+#include "flacfile.hpp"
+#include "saleaesource.hpp"
+#include "replaysource.hpp"
+#include "pipeline.hpp"
+#include "affinity.hpp"
+#include "probe.hpp"
+#include "frameindex.hpp"
+#include "timing.hpp"
+#include "compare.hpp"
 
 //#define NDEBUG
 #define BITS 24
-#define BYTES ((BITS)/8)
 #define CHANNELS 4
 #define WIRES 2
-#define WAIT_SETUP_SEC 1
-#define WAIT_TEARDOWN_SEC 1
+/* How long to wait for the devices to connect */
+#define WAIT_SETUP_SEC 5
+/* Length of the clock measurement for -r auto */
+#define PROBE_SEC 0.1
+/* Samples wanted for the shortest half-period of the bit clock */
+#define PROBE_MARGIN 2
+#define ANALYSIS_FFT_SIZE 8192
+/* SCHED_FIFO priority of the workers with -q, see Pipeline::schedule() */
+#define RT_PRIORITY 50
+/* Logic data a device may queue ahead of its decoder, in seconds */
+#define QUEUE_SEC 1.0
 #define AUDIO_SAMPLING_RATE (48000)
 #if defined(WIN32)
  #define USLEEP(t) Sleep((DWORD) ((t)/1e3))
@@ -51,121 +60,183 @@ void __stdcall OnError( U64 device_id, void* user_data );
 #define DBG(...)
 #endif
 
-#define NUM_ELEMENTS(array) (sizeof(array)/sizeof(array[0]))
-LogicInterface* gDeviceInterface = NULL;
-U64 gLogicId = 0;
 volatile bool loop = true;
-FILE * fdbg = NULL;
-#if USE_WAV
-WavFile * wav = NULL;
-#else
-FILE * wav = NULL;
-#endif
+std::vector<Pipeline *> pipelines;
 
-enum protocol_state {
-	IDLE,
-	FRAME_START,
-	FRAME_FIRST_BIT,
-	FRAME_ACTIVE,
-	DATA_BIT_ACTIVE,
-};
-
-struct protocol_transition {
-	protocol_state current_state;
-	U8 mask;
-	U8 match;
-	protocol_state new_state;
-	void (*transition)(int state_index, U8 data);
-};
-
-protocol_state current_state = IDLE;
-int channel[WIRES*CHANNELS] = { 0 };
-int current_channel;
-int current_bit;
-int ascii = 0;
-volatile unsigned long ndata = 0;
-
-
-void handle_frame_end(int state_index, U8 data)
+void intHandler(int dummy=0) {
+	// catch the ctrl-c
+	loop = false;
+}
+
+/* file.wav -> file_<index>.wav when there is more than one device */
+std::string numbered(const std::string & name, int index, int count)
 {
-	DBG("%s\n", __func__);
-	int channel_count = WIRES * CHANNELS;
-	char arr[WIRES * CHANNELS * BYTES];
-	for (int i = 0; i < channel_count; i++) {
-		arr[i*BYTES+0] = (channel[i] & 0x0000ff) >> 0;
-		arr[i*BYTES+1] = (channel[i] & 0x00ff00) >> 8;
-		arr[i*BYTES+2] = (channel[i] & 0xff0000) >> 16;
+	if(count < 2)
+		return name;
+	std::ostringstream s;
+	size_t dot = name.rfind('.');
+	if(dot == std::string::npos || name.find_first_of("/\\", dot) !=
+	   std::string::npos)
+		dot = name.size();
+	s << name.substr(0, dot) << "_" << index << name.substr(dot);
+	return s.str();
+}
+
+std::string analysis_text(const ChannelAnalysis & a)
+{
+	char text[128];
+	snprintf(text, sizeof(text), "%8.1f Hz %7.2f dBFS THD+N %7.2f dB "
+		 "floor %7.2f dBFS", a.fundamental, a.level, a.thdn,
+		 a.noise_floor);
+	return text;
+}
+
+void show_analysis(VoltMeter & vm, SpectrumAnalyzer * analyzer)
+{
+	std::vector<ChannelAnalysis> r = analyzer->results();
+	for (size_t c = 0; c < r.size(); c++)
+		vm.note((int) c, analysis_text(r[c]));
+}
+
+/*
+ * The levels of every device below a label of its own. A redraw moves
+ * the cursor up over all devices at once, so that they do not draw over
+ * each other.
+ */
+void show_levels(std::vector<VoltMeter *> & meters, bool redraw)
+{
+	int lines = 0;
+	for (size_t i = 0; i < pipelines.size(); i++)
+		if(pipelines[i]->audio())
+			lines += 1 + pipelines[i]->audio()->channelCount();
+	if(redraw) {
+		if (ENABLE_GRAPHICS)
+			printf("\033[%dA", lines);
+		else
+			printf("\r");
 	}
 
-	if(wav) {
-#if USE_WAV
-		if(wav->write(arr, 1) != 1){
-			fprintf(stderr, "Error in writing wav file.\n");
-			exit(1);
-		}
-#else
-		fwrite(arr, sizeof(arr), 1, wav);
-#endif
+	std::vector<double> db;
+	for (size_t i = 0; i < pipelines.size(); i++) {
+		AudioFile * audio = pipelines[i]->audio();
+		if(!audio)
+			continue;
+		db.resize(audio->channelCount());
+		audio->level_db(&db[0]);
+		if(pipelines[i]->analyzer())
+			show_analysis(*meters[i], pipelines[i]->analyzer());
+		if (ENABLE_GRAPHICS)
+			printf("Device %d: %s (id=0x%llx)\n", (int) i,
+			       pipelines[i]->source()->name(),
+			       pipelines[i]->source()->id());
+		else
+			printf("%d: ", (int) i);
+		meters[i]->set(&db[0]);
 	}
-	ndata++;
+}
 
-	current_channel = 0;
-	current_bit = 0;
+void print_timing(int device, TimingAnalyzer * t)
+{
+	const Histogram & fs = t->fsPeriod();
+	if(!fs.count()) {
+		fprintf(stderr, "Device %d: no clock timing.\n", device);
+		return;
+	}
+	double rate = t->rate();
+	fprintf(stderr, "Device %d: FS period %.3f samples (%.2f Hz), "
+		"jitter %.3f rms, %u..%u, 0.1%%..99.9%% %u..%u.\n", device,
+		fs.mean(), rate / fs.mean(), fs.stddev(), fs.min(), fs.max(),
+		fs.percentile(0.001), fs.percentile(0.999));
+	fprintf(stderr, "Device %d: BCLK period %.3f samples (%.4f MHz), "
+		"shortest %u..%u, longest %u..%u.\n", device, t->bitPeriod(),
+		rate / t->bitPeriod() / 1e6, t->bitMin().min(),
+		t->bitMin().max(), t->bitMax().min(), t->bitMax().max());
+	fprintf(stderr, "Device %d: BCLK to FS phase %.3f samples, "
+		"%u..%u.\n", device, t->phase().mean(), t->phase().min(),
+		t->phase().max());
+}
 
-	memset(channel, 0, sizeof(channel));
+FrameIndex * open_index(const std::string & raw_name, CaptureSource * source,
+			int channels, int wires)
+{
+	FrameIndex * index = new FrameIndex();
+	index->create(raw_name + ".idx", source->sampleRate(), BITS,
+		      channels, wires);
+	return index;
 }
 
-void handle_data_bit(int state_index, U8 data)
+void seek_replay(Pipeline * p, ReplaySource * replay,
+		 const std::string & raw_name, double seconds)
 {
-	if(current_channel < CHANNELS){
-		channel[current_channel] <<= 1;
-		channel[current_channel+CHANNELS] <<= 1;
-
-		/* if (data & 0b00000100) */
-		if (data & (0x01<<2))
-			channel[current_channel] |= 1;
-		/* if (data & 0b00001000) */
-		if (data & (0x01<<3))
-			channel[current_channel+CHANNELS] |= 1;
-
-		current_bit++;
-		if (current_bit == BITS) {
-			current_bit = 0;
-			current_channel++;
-		}
+	FrameIndex index;
+	if(!index.load(raw_name + ".idx")) {
+		fprintf(stderr, "Error: no frame index for %s, write one "
+			"with -i.\n", raw_name.c_str());
+		exit(1);
+	}
+	replay->sampleRate(index.rate());
+	const FrameIndexEntry * entry = index.find(seconds);
+	if(!entry) {
+		/* Before the first entry, which is a little into the file */
+		replay->seek(0);
+		std::cerr << "Device " << p->index() << ": no index entry "
+			"before " << seconds << " s, replaying from the "
+			"start." << std::endl;
+		return;
 	}
+	replay->seek(entry->offset);
+	p->seek(*entry);
+	std::cerr << "Device " << p->index() << ": replaying from " <<
+		entry->time_s << " s, frame " << entry->frame << "." <<
+		std::endl;
 }
 
-struct protocol_transition state_machine[] = {
-	//current_state,    mask,      match,  new state
-	{IDLE, 0x01, 0x01, FRAME_START, NULL},
-	{FRAME_START, 0x02, 0x02, FRAME_FIRST_BIT, NULL},
-	{FRAME_FIRST_BIT, 0x02, 0x00, FRAME_START, handle_data_bit},
-	{FRAME_START, 0x01, 0x00, FRAME_ACTIVE, NULL},
-	{FRAME_ACTIVE, 0x02, 0x02, DATA_BIT_ACTIVE, NULL},
-	{DATA_BIT_ACTIVE, 0x02, 0x00, FRAME_ACTIVE, handle_data_bit},
-	{FRAME_ACTIVE, 0x01, 0x01, FRAME_START, handle_frame_end},
-};
-
-void transition(U8 data)
+bool is_flac(const std::string & name)
 {
-	DBG("%s %d\n", __func__, current_state);
-	int i;
-	for (i = 0; i < NUM_ELEMENTS(state_machine); i++) {
-		if (state_machine[i].current_state == current_state &&
-		    (data & state_machine[i].mask) == state_machine[i].match) {
-			if (state_machine[i].transition) {
-				state_machine[i].transition(i, data);
-			}
-			current_state = state_machine[i].new_state;
-			break;
-		}
-	}
+	return name.size() > 5 &&
+		name.compare(name.size() - 5, 5, ".flac") == 0;
 }
 
-void intHandler(int dummy=0) {
-	// catch the ctrl-c
-	loop = false;
+/*
+ * Measure the clocks at the highest rate the source supports and
+ * switch to the lowest one that still samples the bit clock safely.
+ */
+void probe_rate(int index, CaptureSource * source)
+{
+	std::vector<unsigned> rates = source->supportedSampleRates();
+	unsigned highest = source->sampleRate();
+	for (size_t i = 0; i < rates.size(); i++) {
+		if(rates[i] > highest)
+			highest = rates[i];
+	}
+	source->sampleRate(highest);
+
+	ClockProbe probe(highest);
+	probe.capture(source, PROBE_SEC);
+	ClockStats bclk = probe.bitClock();
+	ClockStats fs = probe.frameSync();
+	fprintf(stderr, "Device %d: BCLK %.4f MHz (duty %.0f%%), "
+		"FS %.3f kHz (duty %.1f%%), %.1f bits per frame.\n",
+		index, bclk.frequency / 1e6, bclk.duty * 100,
+		fs.frequency / 1e3, fs.duty * 100,
+		fs.frequency > 0 ? bclk.frequency / fs.frequency : 0.0);
+
+	unsigned rate = probe.pick(rates, PROBE_MARGIN);
+	if(bclk.min_half > 0)
+		fprintf(stderr, "Device %d: %.0f to %.0f samples per BCLK "
+			"half-period at %u Hz (mean %.1f), %d needs %.0f Hz.\n",
+			index, bclk.min_half * highest,
+			bclk.max_half * highest, highest,
+			bclk.mean_half * highest, PROBE_MARGIN,
+			PROBE_MARGIN / bclk.min_half);
+	if(rate == 0) {
+		fprintf(stderr, "Device %d: No safe sampling rate found, "
+			"staying at %u Hz.\n", index, highest);
+		return;
+	}
+	source->sampleRate(rate);
+	fprintf(stderr, "Device %d: Using %u Hz (%.1fx less data).\n",
+		index, rate, (double) highest / rate);
 }
 
 int main( int argc, char *argv[])
@@ -173,8 +244,30 @@ int main( int argc, char *argv[])
 	DBG("%s\n", __func__);
 	signal(SIGINT, intHandler);
 	U32 gSampleRateHz = 24000000;
+	bool auto_rate = false;
+	int channels = CHANNELS;
+	int wires = WIRES;
+	int encoder_threads = 2;
+	bool analysis = false;
+	bool write_index = false;
+	bool direct_io = false;
+	bool timing = false;
+	bool timing_track = false;
+	std::string reference_file;
+	unsigned tolerance_lsb = 0;
+	std::vector<int> cores;
+	bool realtime = false;
+	bool lock = false;
+	double seek_sec = 0;
 	int readtime_sec = -1;
 	bool verbose = false;
+	std::vector<std::string> replay_files;
+	bool replay_realtime = true;
+	double replay_error_sec = 0;
+	double queue_sec = QUEUE_SEC;
+	int device_count = 1;
+	std::string wav_file;
+	std::string raw_file;
 	assert(sizeof(int) == 4);
 
 
@@ -182,24 +275,53 @@ int main( int argc, char *argv[])
 		std::string arg(argv[i]);
 		if(arg == "-h"){
 			std::cout << "usage: " << argv[0]
-				  << " [-v] " 
-				  << "[-r rate] "
+				  << " [-v] [-a] [-i] [-s sec] [-o] [-k] [-x] [-m reference.wav [-l lsb]] [-g cores] [-q] [-u] [-b sec] " 
+				  << "[-r rate|auto] "
+				  << "[-w wires] "
+				  << "[-c slots] "
 				  << "[-t time] "
 				  << "[-d raw_data.bin] " 
-				  << "[file.wav] "
+				  << "[-n devices] "
+				  << "[-p raw_data.bin [-f] [-e time]] "
+				  << "[-j threads] "
+				  << "[file.wav|file.flac] "
 				  << std::endl;
 			printf("Options:\n");
 			printf(" %-20s%s\n", "-v", "Verbose mode");
-			printf(" %-20s%s (%ld hz).\n", "-r", "Logic sampling rate", gSampleRateHz);
+			printf(" %-20s%s\n", "-a", "Spectrum analysis, fundamental, THD+N and noise floor");
+			printf(" %-20s%s\n", "-k", "Clock timing analysis, FS and BCLK period and phase");
+			printf(" %-20s%s\n", "-x", "Clock timing analysis with a timing track, file.tim after the audio, -d or -p file");
+			printf(" %-20s%s (%u hz).\n", "-r", "Logic sampling rate", gSampleRateHz);
+			printf(" %-20s%s\n", "-r auto", "Measure the bit clock and use the lowest safe rate");
+			printf(" %-20s%s (%d, max %d).\n", "-w", "Number of data wires", wires, I2sDecoder::MAX_WIRES);
+			printf(" %-20s%s (%d).\n", "-c", "TDM slots per data wire", channels);
 			printf(" %-20s%s\n", "-t", "Recogding time in seconds");
 			printf(" %-20s%s\n", "-d", "Crate raw data file");
+			printf(" %-20s%s\n", "-o", "Write the raw data and WAV files with direct I/O");
+			printf(" %-20s%s\n", "-p", "Replay raw data file instead of a device, repeat for more devices");
+			printf(" %-20s%s\n", "-f", "Replay as fast as possible, not at sampling rate");
+			printf(" %-20s%s\n", "-i", "Write a frame index of the replayed file (file.idx)");
+			printf(" %-20s%s\n", "-s", "Replay from this many seconds on, using file.idx");
+			printf(" %-20s%s\n", "-e", "Replay with an error every time seconds");
+			printf(" %-20s%s (%d).\n", "-n", "Number of devices to wait for", device_count);
+			printf(" %-20s%s\n", "-m", "Compare the WAV file against a reference instead of capturing");
+			printf(" %-20s%s (%u).\n", "-l", "Allowed difference in LSBs for -m", tolerance_lsb);
 			printf(" %-20s%s\n", "-h", "Usage instructions");
+			printf(" %-20s%s (%d).\n", "-j", "FLAC encoder threads per device", encoder_threads);
+			printf(" %-20s%s\n", "-g", "Cores for the device workers, then one writer and one callback core per device, e.g. 1,2,3,4,5,6");
+			printf(" %-20s%s\n", "-q", "Real-time priority (SCHED_FIFO) where permitted");
+			printf(" %-20s%s\n", "-u", "Lock all memory (mlockall)");
+			printf(" %-20s%s (%g).\n", "-b", "Seconds of logic data queued before an overrun", queue_sec);
 			printf(" %-20s%s\n", "file.wav", "Create wav file");
+			printf(" %-20s%s\n", "file.flac", "Create lossless compressed FLAC file, up to 8 channels");
+			std::cout << std::endl << "With several devices connected each one gets"
+				  << " its own files, file_0.wav, file_1.wav, ..." << std::endl;
 			std::cout << std::endl << std::endl << "Logic wiring:" << std::endl;
 			std::cout << " 1 - Frame Sync" << std::endl;
 			std::cout << " 2 - Bit Clock" << std::endl;
-			std::cout << " 3 - Data 1" << std::endl;
-			std::cout << " 4 - Data 2" << std::endl;
+			for (int w = 0; w < I2sDecoder::MAX_WIRES; w++)
+				std::cout << " " << w + 3 << " - Data " <<
+					w + 1 << std::endl;
 			std::cout << "Note! TDM DSP Mode B, "
 				  << " (bit clock inverted)"  << std::endl;
 			DevicesManagerInterface::BeginConnect(); // Bug in SDK
@@ -207,9 +329,33 @@ int main( int argc, char *argv[])
 		}
 
 		if(arg == "-r" && i + 1 < argc){
+			++i;
+			if(std::string(argv[i]) == "auto")
+				auto_rate = true;
+			else
+				std::istringstream ( std::string(argv[i]) ) >>
+					gSampleRateHz;
+			continue;
+		}
+
+		if(arg == "-w" && i + 1 < argc){
+			++i;
+			std::istringstream ( std::string(argv[i]) ) >>
+				wires;
+			continue;
+		}
+
+		if(arg == "-c" && i + 1 < argc){
 			++i;
 			std::istringstream ( std::string(argv[i]) ) >>
-				gSampleRateHz;
+				channels;
+			continue;
+		}
+
+		if(arg == "-j" && i + 1 < argc){
+			++i;
+			std::istringstream ( std::string(argv[i]) ) >>
+				encoder_threads;
 			continue;
 		}
 
@@ -218,12 +364,106 @@ int main( int argc, char *argv[])
 			continue;
 		}
 
+		if(arg == "-a"){
+			analysis = true;
+			continue;
+		}
+
 		if(arg == "-d" && i + 1 < argc){
 			++i;
-			std::cout << "Opening raw data file:" <<  argv[i] <<
-				"." << std::endl;
-			fdbg = fopen(argv[i], "wb");
-			assert(fdbg);
+			raw_file = argv[i];
+			continue;
+		}
+
+		if(arg == "-p" && i + 1 < argc){
+			++i;
+			replay_files.push_back(argv[i]);
+			continue;
+		}
+
+		if(arg == "-f"){
+			replay_realtime = false;
+			continue;
+		}
+
+		if(arg == "-i"){
+			write_index = true;
+			continue;
+		}
+
+		if(arg == "-o"){
+			direct_io = true;
+			continue;
+		}
+
+		if(arg == "-m" && i + 1 < argc){
+			++i;
+			reference_file = argv[i];
+			continue;
+		}
+
+		if(arg == "-l" && i + 1 < argc){
+			++i;
+			std::istringstream ( std::string(argv[i]) ) >>
+				tolerance_lsb;
+			continue;
+		}
+
+		if(arg == "-g" && i + 1 < argc){
+			++i;
+			std::istringstream list ( std::string(argv[i]) );
+			std::string core;
+			while(std::getline(list, core, ','))
+				cores.push_back(atoi(core.c_str()));
+			continue;
+		}
+
+		if(arg == "-q"){
+			realtime = true;
+			continue;
+		}
+
+		if(arg == "-u"){
+			lock = true;
+			continue;
+		}
+
+		if(arg == "-k"){
+			timing = true;
+			continue;
+		}
+
+		if(arg == "-x"){
+			timing = true;
+			timing_track = true;
+			continue;
+		}
+
+		if(arg == "-s" && i + 1 < argc){
+			++i;
+			std::istringstream ( std::string(argv[i]) ) >>
+				seek_sec;
+			continue;
+		}
+
+		if(arg == "-e" && i + 1 < argc){
+			++i;
+			std::istringstream ( std::string(argv[i]) ) >>
+				replay_error_sec;
+			continue;
+		}
+
+		if(arg == "-b" && i + 1 < argc){
+			++i;
+			std::istringstream ( std::string(argv[i]) ) >>
+				queue_sec;
+			continue;
+		}
+
+		if(arg == "-n" && i + 1 < argc){
+			++i;
+			std::istringstream ( std::string(argv[i]) ) >>
+				device_count;
 			continue;
 		}
 
@@ -233,141 +473,323 @@ int main( int argc, char *argv[])
 				readtime_sec;
 			continue;
 		}
-#if USE_WAV
-		wav = new WavFile(arg, "wb");
-		wav->sampleRate(AUDIO_SAMPLING_RATE);
-		wav->channelCount(WIRES * CHANNELS);
-		wav->bitsPerSample(BITS);
-#else
-		wav = fopen(arg.c_str(), "wb");
-#endif
-		assert(wav);
+		wav_file = arg;
+	}
+
+	if(!reference_file.empty()) {
+		if(wav_file.empty()) {
+			std::cerr << "Sorry, -m needs a WAV file to check." <<
+				std::endl;
+			return 1;
+		}
+		WavCompare compare(reference_file, wav_file);
+		compare.tolerance(tolerance_lsb);
+		return compare.run() ? 0 : 1;
+	}
+
+	if(timing_track && wav_file.empty() && raw_file.empty() &&
+	   replay_files.empty()) {
+		std::cerr << "Sorry, -x names the timing track after the "
+			"audio file or the -d file, give one of them." <<
+			std::endl;
+		return 1;
 	}
 
-	DevicesManagerInterface::RegisterOnConnect( &OnConnect,
-						    &gSampleRateHz);
-	DevicesManagerInterface::RegisterOnDisconnect( &OnDisconnect );
-	DevicesManagerInterface::BeginConnect();
+	for (size_t i = 0; i < cores.size(); i++) {
+		if(cores[i] < 0 || cores[i] >= cpu_count()) {
+			std::cerr << "Sorry, there is no core " << cores[i] <<
+				", -g takes 0 to " << cpu_count() - 1 << "." <<
+				std::endl;
+			return 1;
+		}
+	}
 
-	USLEEP(WAIT_SETUP_SEC*1e6);
-	if (gDeviceInterface == NULL){
+	if(is_flac(wav_file)) {
+		/* The encoder starts with the first frame, check it now */
+		if(!FlacFile::supports(wires * channels, BITS)) {
+			std::cerr << "Sorry, FLAC holds up to " <<
+				FlacFile::MAX_CHANNELS << " channels, " <<
+				wires * channels << " were asked for. " <<
+				"Use a WAV file." << std::endl;
+			return 1;
+		}
+		if(direct_io)
+			std::cerr << "Note: FLAC files are written without "
+				"direct I/O, -o only applies to -d." <<
+				std::endl;
+	}
+
+	/* Before the buffers are allocated, so they are locked as well */
+	if(lock && !lock_memory())
+		std::cerr << "Could not lock memory." << std::endl;
+	ThreadCounters start_counters;
+	bool counted = process_counters(&start_counters);
+
+	/* Skipped data would shift the offsets of a replay index */
+	if(write_index && replay_error_sec > 0) {
+		std::cerr << "Sorry, -i and -e do not go together." <<
+			std::endl;
+		return 1;
+	}
+	/* A device has one index, for the dump when there is one */
+	if(write_index && (!raw_file.empty() || seek_sec > 0)) {
+		std::cerr << "Sorry, -i does not go with -s, or with -d "
+			"which writes an index of its own." << std::endl;
+		return 1;
+	}
+
+	std::vector<CaptureSource *> sources;
+	if(!replay_files.empty()) {
+		for (size_t i = 0; i < replay_files.size(); i++) {
+			ReplaySource * replay =
+				new ReplaySource(replay_files[i], i);
+			replay->realtime(replay_realtime);
+			replay->injectErrors((unsigned long long)
+					     (replay_error_sec * gSampleRateHz));
+			sources.push_back(replay);
+		}
+	} else {
+		SaleaeSource::beginConnect();
+		std::vector<SaleaeSource *> devices =
+			SaleaeSource::waitForDevices(device_count,
+						     WAIT_SETUP_SEC);
+		sources.assign(devices.begin(), devices.end());
+	}
+	if (sources.empty()){
 		std::cerr << "Sorry, no devices are connected." << std::endl;
 		return 1;
 	}
-	gDeviceInterface->ReadStart();
+
+	int count = (int) sources.size();
+	for (int i = 0; i < count; i++) {
+		sources[i]->sampleRate(gSampleRateHz);
+		if(auto_rate) {
+			probe_rate(i, sources[i]);
+			sources[i]->clearError();
+			/* The probe read the start of the replay */
+			if(i < (int) replay_files.size())
+				((ReplaySource *) sources[i])->seek(0);
+		}
+		Pipeline * p = new Pipeline(i, sources[i], BITS, channels,
+					    wires);
+		p->maxQueue(queue_sec);
+		std::cerr << "Device " << i << ": " << sources[i]->name() <<
+			" (id=0x" << std::hex << sources[i]->id() <<
+			std::dec << ") at " << sources[i]->sampleRate() <<
+			"Hz." << std::endl;
+
+		if(!raw_file.empty()) {
+			std::string name = numbered(raw_file, i, count);
+			std::cout << "Opening raw data file:" << name <<
+				"." << std::endl;
+			if(direct_io) {
+				p->dump(new DirectWriter(name));
+			} else {
+				FILE * fdbg = fopen(name.c_str(), "wb");
+				assert(fdbg);
+				p->dump(fdbg);
+			}
+			p->index(open_index(name, sources[i], channels,
+					    wires));
+		}
+
+		if(i < (int) replay_files.size()) {
+			if(seek_sec > 0)
+				seek_replay(p, (ReplaySource *) sources[i],
+					    replay_files[i], seek_sec);
+			else if(write_index)
+				p->index(open_index(replay_files[i],
+						    sources[i], channels,
+						    wires));
+		}
+
+		if(!wav_file.empty()) {
+			std::string name = numbered(wav_file, i, count);
+#if USE_WAV
+			if(is_flac(name)) {
+				FlacFile * flac = new FlacFile(name,
+							       encoder_threads);
+				flac->sampleRate(AUDIO_SAMPLING_RATE);
+				flac->channelCount(wires * channels);
+				flac->bitsPerSample(BITS);
+				p->output(flac);
+			} else {
+				WavFile * wav = new WavFile(name, "wb");
+				if(direct_io)
+					wav->directIo();
+				wav->sampleRate(AUDIO_SAMPLING_RATE);
+				wav->channelCount(wires * channels);
+				wav->bitsPerSample(BITS);
+				p->output(wav);
+			}
+#else
+			FILE * wav = fopen(name.c_str(), "wb");
+			assert(wav);
+			p->output(wav);
+#endif
+		}
+		if(analysis)
+			p->analyze(new SpectrumAnalyzer(wires * channels, BITS,
+							AUDIO_SAMPLING_RATE,
+							ANALYSIS_FFT_SIZE));
+		if(timing) {
+			TimingAnalyzer * t =
+				new TimingAnalyzer(sources[i]->sampleRate());
+			if(timing_track) {
+				/* Next to the audio, else to the logic data */
+				std::string name = !wav_file.empty() ?
+					numbered(wav_file, i, count) :
+					!raw_file.empty() ?
+					numbered(raw_file, i, count) :
+					replay_files[i];
+				t->track(name + ".tim");
+			}
+			p->timing(t);
+		}
+		pipelines.push_back(p);
+	}
+
+	/*
+	 * Keep core 0 for the SDK and the main loop when there is room,
+	 * and give every device a core of its own, unless told otherwise.
+	 */
+	int first_cpu = cpu_count() > count ? 1 : 0;
+	for (int i = 0; i < count; i++) {
+		int cpu = cpu_count() > 1 ? first_cpu + i : -1;
+		int writer_cpu = -1;
+		int callback_cpu = -1;
+		if(!cores.empty()) {
+			cpu = i < (int) cores.size() ? cores[i] : -1;
+			writer_cpu = count + i < (int) cores.size() ?
+				cores[count + i] : -1;
+			callback_cpu = 2 * count + i < (int) cores.size() ?
+				cores[2 * count + i] : -1;
+		}
+		pipelines[i]->schedule(writer_cpu, callback_cpu,
+				       realtime ? RT_PRIORITY : 0);
+		pipelines[i]->start(cpu);
+	}
+	/* Restarts after errors come from the main loop */
+	if(realtime && !realtime_current_thread(RT_PRIORITY - 2))
+		std::cerr << "Could not raise the priority of the main "
+			"loop." << std::endl;
 
 	if(readtime_sec>0)
 		std::cerr << "Reading data for " << readtime_sec <<
 			" seconds." << std::endl;
 
-	VoltMeter vm(WIRES * CHANNELS, 10, -130, 0, 20, ENABLE_GRAPHICS);
+	/* A meter per device, each with its own peak hold */
+	std::vector<VoltMeter *> meters;
+	for (int i = 0; i < count; i++)
+		meters.push_back(new VoltMeter(wires * channels, 10, -130, 0,
+					       20, ENABLE_GRAPHICS));
 	std::cerr << "Press CTRL-C to quit" << std::endl;
 
 #if USE_WAV
-	double db[2*CHANNELS];
-	if(wav && verbose) {
-		wav->level_db(db);
-		vm.set(db);
-	}
+	if(verbose)
+		show_levels(meters, false);
 #endif
 
 	while(loop){
-		USLEEP(0.19 * 1e6);
-#if USE_WAV
-		if(verbose && wav){
-			if (ENABLE_GRAPHICS)
-				printf("\033[%dA", wav->channelCount());
-			else
-				printf("\r");
-			wav->level_db(db);
-			vm.set(db);
+		CaptureSource::waitEvent(0.19);
+		unsigned long ndata = pipelines[0]->frames();
+		bool exhausted = true;
+		for (int i = 0; i < count; i++) {
+			Pipeline * p = pipelines[i];
+			if(p->source()->failed() && p->source()->connected())
+				p->restart();
+			if(p->frames() < ndata)
+				ndata = p->frames();
+			if(!p->source()->exhausted())
+				exhausted = false;
 		}
+#if USE_WAV
+		if(verbose)
+			show_levels(meters, true);
 #endif
 		fprintf(stderr, " %10.2f s.\r", (double) ndata/AUDIO_SAMPLING_RATE);
 		if(readtime_sec > 0 && (double)ndata/AUDIO_SAMPLING_RATE > readtime_sec){
 			loop = false;
 		}
+		if(exhausted)
+			loop = false;
 	}
 
-	if(gDeviceInterface->IsStreaming())
-		gDeviceInterface->Stop();
-
-	std::cerr << std::endl << ndata << " samples read." << std::endl;
-	USLEEP(WAIT_TEARDOWN_SEC*1e6);
-
-	if(fdbg)
-		fclose(fdbg);
-
-	if(wav) {
-#if USE_WAV
-		delete wav;
-#else
-		fclose(wav);
-#endif
-		wav = NULL;
-	}
-
-	return 0;
-}
+	for (int i = 0; i < count; i++)
+		pipelines[i]->source()->stop();
 
-void __stdcall OnConnect( U64 device_id, GenericInterface* device_interface,
-			  void* user_data )
-{
-	DBG("%s\n", __func__);
+	std::cerr << std::endl;
+	/* Let the workers drain their queues before reporting */
+	for (int i = 0; i < count; i++)
+		pipelines[i]->stop();
 
-	if( dynamic_cast<LogicInterface*>( device_interface ) != NULL ){
-		U32* gSampleRateHz = (U32*) user_data;
-		std::cerr << "A Logic device was connected (id=0x" <<
-			std::hex << device_id << std::dec <<  ") at " <<
-			*gSampleRateHz << "Hz." << std::endl;
-		gDeviceInterface = (LogicInterface*)device_interface;
-		gLogicId = device_id;
-		gDeviceInterface->RegisterOnReadData( &OnReadData );
-		gDeviceInterface->RegisterOnError( &OnError );
-		gDeviceInterface->SetSampleRateHz( *gSampleRateHz );
+	double first_start = 0;
+	for (int i = 0; i < count; i++) {
+		PipelineStats s = pipelines[i]->stats();
+		if(i == 0 || s.start_s < first_start)
+			first_start = s.start_s;
 	}
-}
-
-void __stdcall OnDisconnect( U64 device_id, void* user_data )
-{
-	DBG("%s\n", __func__);
-	if( device_id == gLogicId ){
-		std::cerr << "A device was disconnected (id=0x" <<
-			std::hex << device_id << std::dec << ")." <<
+	for (int i = 0; i < count; i++) {
+		PipelineStats s = pipelines[i]->stats();
+		std::cerr << "Device " << i << ": " << s.frames <<
+			" samples read, " << s.bytes << " bytes in " <<
+			s.buffers << " buffers, max " << s.max_queued <<
+			" queued, started +" <<
+			(s.start_s - first_start) * 1e3 << " ms, " <<
+			s.errors << " errors, " << s.lost_s * 1e3 <<
+			" ms lost, " << s.dropped << " bytes dropped." <<
 			std::endl;
-		gDeviceInterface = NULL;
+		if(s.counted && (verbose || realtime || lock))
+			std::cerr << "Device " << i << ": worker had " <<
+				s.worker.minor_faults << " minor and " <<
+				s.worker.major_faults << " major page faults, " <<
+				s.worker.voluntary_switches << " voluntary and " <<
+				s.worker.involuntary_switches <<
+				" involuntary context switches." << std::endl;
+		DirectWriter * d = pipelines[i]->directDump();
+		if(d)
+			std::cerr << "Device " << i << ": raw data written " <<
+				(d->direct() ? "with" : "without") <<
+				" direct I/O, max " << d->maxInFlight() / 1024 <<
+				" KiB in flight, waited " << d->stalls() <<
+				" times." << std::endl;
 	}
-}
-
-void __stdcall OnReadData( U64 device_id, U8* data, U32 data_length,
-			   void* user_data )
-{
-	DBG("%s\n", __func__);
-	if(fdbg)
-		fwrite(data, sizeof(U8), data_length, fdbg);
 
-	for (unsigned i = 0; i < data_length; i++) {
-		transition(data[i]);
+	ThreadCounters end_counters;
+	if(counted && process_counters(&end_counters) &&
+	   (verbose || realtime || lock))
+		std::cerr << "Capture had " << end_counters.minor_faults -
+			start_counters.minor_faults << " minor and " <<
+			end_counters.major_faults - start_counters.major_faults <<
+			" major page faults, " <<
+			end_counters.involuntary_switches -
+			start_counters.involuntary_switches <<
+			" involuntary context switches." << std::endl;
+
+	for (int i = 0; i < count; i++) {
+		TimingAnalyzer * t = pipelines[i]->timing();
+		if(t)
+			print_timing(i, t);
 	}
 
-	/*
-	 * you own this data.  You don't have to delete it immediately,
-	 * you could keep it and process it later, for example,
-	 * or pass it to another thread for processing.
-	 */
-	DevicesManagerInterface::DeleteU8ArrayPtr( data );
-}
+	for (int i = 0; i < count; i++) {
+		SpectrumAnalyzer * a = pipelines[i]->analyzer();
+		if(!a)
+			continue;
+		std::vector<ChannelAnalysis> r = a->results();
+		for (size_t c = 0; c < r.size(); c++)
+			fprintf(stderr, "Device %d channel %d: %s\n", i, (int) c,
+				analysis_text(r[c]).c_str());
+		if(a->dropped())
+			fprintf(stderr, "Device %d: analysis skipped %lu "
+				"frames.\n", i, a->dropped());
+	}
 
+	for (int i = 0; i < count; i++) {
+		delete pipelines[i];
+		delete meters[i];
+	}
+	pipelines.clear();
 
-void __stdcall OnError( U64 device_id, void* user_data )
-{
-	DBG("%s\n", __func__);
-	std::cerr << "A device reported an Error. This probably means that it could not keep up at the given data rate, or was disconnected. You can re-start the capture automatically, if your application can tolerate gaps in the data." << std::endl;
-	/*
-	 * note that you should not attempt to restart data collection
-	 *  from this function --
-	 * you'll need to do it from your main thread
-	 * (or at least not the one that just called this function).
-	 */
-	exit(EXIT_FAILURE);
+	return 0;
 }
@@ -0,0 +1,130 @@
+#if defined(WIN32)
+ #include <windows.h>
+#else
+ #include <pthread.h>
+ #include <sched.h>
+ #include <sys/mman.h>
+ #include <sys/time.h>
+ #include <sys/resource.h>
+#endif
+#include <cstring>
+#include "affinity.hpp"
+
+int cpu_count()
+{
+	int n = (int) std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+#if defined(WIN32)
+static bool pin(HANDLE thread, int cpu)
+{
+	if(cpu < 0 || cpu >= cpu_count() ||
+	   cpu >= (int) (sizeof(DWORD_PTR) * 8))
+		return false;
+	return SetThreadAffinityMask(thread, (DWORD_PTR) 1 << cpu) != 0;
+}
+
+static bool raise_priority(HANDLE thread, int priority)
+{
+	return SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL) != 0;
+}
+#else
+static bool pin(pthread_t thread, int cpu)
+{
+	if(cpu < 0 || cpu >= cpu_count())
+		return false;
+ #if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+ #else
+	/* No thread affinity API on OS X */
+	return false;
+ #endif
+}
+
+static bool raise_priority(pthread_t thread, int priority)
+{
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	/* Needs root or CAP_SYS_NICE, or an rtprio limit */
+	return pthread_setschedparam(thread, SCHED_FIFO, &param) == 0;
+}
+#endif
+
+bool pin_thread(std::thread & thread, int cpu)
+{
+	return pin(thread.native_handle(), cpu);
+}
+
+bool pin_current_thread(int cpu)
+{
+#if defined(WIN32)
+	return pin(GetCurrentThread(), cpu);
+#else
+	return pin(pthread_self(), cpu);
+#endif
+}
+
+bool realtime_thread(std::thread & thread, int priority)
+{
+	return raise_priority(thread.native_handle(), priority);
+}
+
+bool realtime_current_thread(int priority)
+{
+#if defined(WIN32)
+	return raise_priority(GetCurrentThread(), priority);
+#else
+	return raise_priority(pthread_self(), priority);
+#endif
+}
+
+bool lock_memory()
+{
+#if defined(WIN32)
+	return false;
+#else
+	return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#endif
+}
+
+#if !defined(WIN32)
+static void counters_from(const struct rusage & usage,
+			  ThreadCounters * counters)
+{
+	counters->minor_faults = usage.ru_minflt;
+	counters->major_faults = usage.ru_majflt;
+	counters->voluntary_switches = usage.ru_nvcsw;
+	counters->involuntary_switches = usage.ru_nivcsw;
+}
+#endif
+
+bool thread_counters(ThreadCounters * counters)
+{
+#if defined(__linux__)
+	struct rusage usage;
+	if(getrusage(RUSAGE_THREAD, &usage))
+		return false;
+	counters_from(usage, counters);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool process_counters(ThreadCounters * counters)
+{
+#if defined(WIN32)
+	return false;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage))
+		return false;
+	counters_from(usage, counters);
+	return true;
+#endif
+}
@@ -0,0 +1,36 @@
+#ifndef AFFINITY_HPP_
+#define AFFINITY_HPP_
+
+#include <thread>
+
+int cpu_count();
+/*
+ * Pin a thread to one core, returns false if not supported or there is
+ * no such core.
+ */
+bool pin_thread(std::thread & thread, int cpu);
+bool pin_current_thread(int cpu);
+
+/*
+ * Real-time priority, SCHED_FIFO 1..99 on Linux and OS X, above normal
+ * on Windows. Returns false when not permitted.
+ */
+bool realtime_thread(std::thread & thread, int priority);
+bool realtime_current_thread(int priority);
+
+/* Lock all current and future pages of the process in memory. */
+bool lock_memory();
+
+struct ThreadCounters {
+	long minor_faults;
+	long major_faults;
+	long voluntary_switches;
+	long involuntary_switches;
+};
+
+/* Counters of the calling thread, false if not supported. */
+bool thread_counters(ThreadCounters * counters);
+/* Counters of the whole process */
+bool process_counters(ThreadCounters * counters);
+
+#endif
@@ -0,0 +1,239 @@
+#define _USE_MATH_DEFINES
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include "analyzer.hpp"
+
+/* Ring of about half a second at 48 kHz */
+#define ANALYZER_RING_FRAMES 32768
+/*
+ * The 7-term Blackman-Harris main lobe is +-7 bins, the leakage of a
+ * tone between bins is below -150 dB a few bins further out.
+ */
+#define ANALYZER_LOBE_BINS 10
+#define ANALYZER_LOW_HZ 20.0
+#define ANALYZER_HIGH_HZ 20000.0
+
+SpectrumAnalyzer::SpectrumAnalyzer(int channels, int bits, int rate,
+				   int size)
+	:channels_(channels), bytes_(bits / 8), rate_(rate), size_(size),
+	 fft_(size), ring_frames_(ANALYZER_RING_FRAMES), head_(0), tail_(0),
+	 dropped_(0), pending_break_(false), window_(size), window_power_(0), filled_(0),
+	 averaged_(false), running_(false)
+{
+	ring_.resize((size_t) ring_frames_ * channels_ * bytes_);
+	ring_break_.resize(ring_frames_);
+	input_.resize((size_t) size_ * channels_);
+	re_.resize(size_);
+	im_.resize(size_);
+	power_.resize((size_t) size_ / 2 * channels_);
+	sorted_.resize(size_ / 2);
+
+	/*
+	 * 7-term Blackman-Harris, sidelobes below -180 dB. With the -92 dB
+	 * of the 4-term window the leakage of a tone that falls between
+	 * bins set the THD+N floor, a clean 24 bit 1 kHz sine read -88 dB.
+	 */
+	static const double a[7] = {
+		0.27105140069342, 0.43329793923448, 0.21812299954311,
+		0.06592544638803, 0.01081174209837, 0.00077658482522,
+		0.00001388721735
+	};
+	for (int i = 0; i < size_; i++) {
+		double x = 2 * M_PI * i / size_;
+		double w = 0;
+		for (int k = 0; k < 7; k++)
+			w += (k & 1 ? -a[k] : a[k]) * cos(k * x);
+		window_[i] = (float) w;
+		window_power_ += (double) window_[i] * window_[i];
+	}
+
+	ChannelAnalysis none = { 0, -INFINITY, NAN, -INFINITY };
+	results_.assign(channels_, none);
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+	stop();
+}
+
+void SpectrumAnalyzer::push(const char * frame)
+{
+	unsigned head = head_.load(std::memory_order_relaxed);
+	unsigned tail = tail_.load(std::memory_order_acquire);
+	if(head - tail >= ring_frames_) {
+		dropped_++;
+		pending_break_ = true;
+		return;
+	}
+	size_t size = (size_t) channels_ * bytes_;
+	memcpy(&ring_[(head % ring_frames_) * size], frame, size);
+	ring_break_[head % ring_frames_] = pending_break_;
+	pending_break_ = false;
+	head_.store(head + 1, std::memory_order_release);
+}
+
+void SpectrumAnalyzer::reset()
+{
+	pending_break_ = true;
+}
+
+void SpectrumAnalyzer::start()
+{
+	running_ = true;
+	thread_ = std::thread(&SpectrumAnalyzer::run, this);
+}
+
+void SpectrumAnalyzer::stop()
+{
+	running_ = false;
+	if(thread_.joinable())
+		thread_.join();
+}
+
+std::vector<ChannelAnalysis> SpectrumAnalyzer::results()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return results_;
+}
+
+unsigned long SpectrumAnalyzer::dropped() const
+{
+	return dropped_;
+}
+
+void SpectrumAnalyzer::run()
+{
+	size_t size = (size_t) channels_ * bytes_;
+	float scale = 1.0f / (1U << (8 * bytes_ - 1));
+	while(running_) {
+		unsigned tail = tail_.load(std::memory_order_relaxed);
+		unsigned head = head_.load(std::memory_order_acquire);
+		if(head == tail) {
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(10));
+			continue;
+		}
+		for (; tail != head; tail++) {
+			const unsigned char * p = (const unsigned char *)
+				&ring_[(tail % ring_frames_) * size];
+			/* Start over, the window must be continuous */
+			if(ring_break_[tail % ring_frames_])
+				filled_ = 0;
+			for (int c = 0; c < channels_; c++) {
+				int value = 0;
+				for (int b = 0; b < bytes_; b++)
+					value |= (unsigned) *p++ <<
+						(8 * b + 32 - 8 * bytes_);
+				value >>= 32 - 8 * bytes_;
+				input_[(size_t) c * size_ + filled_] =
+					value * scale;
+			}
+			if(++filled_ == size_) {
+				analyze();
+				/* Half overlap, keep the newer half */
+				for (int c = 0; c < channels_; c++) {
+					float * in = &input_[(size_t) c * size_];
+					memmove(in, in + size_ / 2,
+						sizeof(float) * (size_ / 2));
+				}
+				filled_ = size_ / 2;
+			}
+		}
+		tail_.store(tail, std::memory_order_release);
+	}
+}
+
+void SpectrumAnalyzer::analyze()
+{
+	int half = size_ / 2;
+	float * re = &re_[0];
+	float * im = &im_[0];
+
+	/* Two real channels per complex FFT */
+	for (int c = 0; c < channels_; c += 2) {
+		const float * a = &input_[(size_t) c * size_];
+		const float * b = c + 1 < channels_ ?
+			&input_[(size_t) (c + 1) * size_] : NULL;
+		for (int i = 0; i < size_; i++) {
+			re[i] = a[i] * window_[i];
+			im[i] = b ? b[i] * window_[i] : 0.0f;
+		}
+		fft_.forward(re, im);
+
+		float * pa = &power_[(size_t) c * half];
+		float * pb = b ? &power_[(size_t) (c + 1) * half] : NULL;
+		for (int k = 0; k < half; k++) {
+			int nk = (size_ - k) & (size_ - 1);
+			float ar = (re[k] + re[nk]) * 0.5f;
+			float ai = (im[k] - im[nk]) * 0.5f;
+			float br = (im[k] + im[nk]) * 0.5f;
+			float bi = (re[nk] - re[k]) * 0.5f;
+			float p = ar * ar + ai * ai;
+			pa[k] = averaged_ ? 0.5f * (pa[k] + p) : p;
+			if(pb) {
+				p = br * br + bi * bi;
+				pb[k] = averaged_ ? 0.5f * (pb[k] + p) : p;
+			}
+		}
+	}
+	averaged_ = true;
+
+	for (int c = 0; c < channels_; c++)
+		measure(c, &power_[(size_t) c * half]);
+}
+
+void SpectrumAnalyzer::measure(int ch, const float * power)
+{
+	int half = size_ / 2;
+	int low = (int) ceil(ANALYZER_LOW_HZ * size_ / rate_);
+	if(low < ANALYZER_LOBE_BINS)
+		low = ANALYZER_LOBE_BINS;
+	int high = (int) (ANALYZER_HIGH_HZ * size_ / rate_);
+	if(high > half - 1)
+		high = half - 1;
+
+	double total = 0;
+	int peak = low;
+	for (int k = low; k <= high; k++) {
+		total += power[k];
+		if(power[k] > power[peak])
+			peak = k;
+	}
+
+	int from = std::max(low, peak - ANALYZER_LOBE_BINS);
+	int to = std::min(high, peak + ANALYZER_LOBE_BINS);
+	double lobe = 0;
+	for (int k = from; k <= to; k++)
+		lobe += power[k];
+
+	/* Parabolic interpolation of the log power around the peak */
+	double delta = 0;
+	if(peak > low && peak < high && power[peak-1] > 0 &&
+	   power[peak+1] > 0) {
+		double l = log(power[peak-1]);
+		double c = log(power[peak]);
+		double r = log(power[peak+1]);
+		if(l - 2 * c + r != 0)
+			delta = 0.5 * (l - r) / (l - 2 * c + r);
+	}
+
+	int n = high - low + 1;
+	std::copy(power + low, power + high + 1, sorted_.begin());
+	std::nth_element(sorted_.begin(), sorted_.begin() + n / 2,
+			 sorted_.begin() + n);
+	double median = sorted_[n / 2];
+
+	/* A full scale sine puts N * sum(w^2) / 4 in its positive lobe */
+	double fs = size_ * window_power_ / 4;
+	ChannelAnalysis a;
+	a.fundamental = (peak + delta) * rate_ / size_;
+	a.level = 10 * log10(lobe / fs);
+	a.thdn = total > 0 ? 10 * log10((total - lobe) / total) : NAN;
+	a.noise_floor = 10 * log10(median / fs);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	results_[ch] = a;
+}
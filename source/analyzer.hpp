@@ -0,0 +1,77 @@
+#ifndef ANALYZER_HPP_
+#define ANALYZER_HPP_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "fft.hpp"
+
+struct ChannelAnalysis {
+	double fundamental;	/* Hz */
+	double level;		/* dBFS of the fundamental */
+	double thdn;		/* dB relative to the total */
+	double noise_floor;	/* Median bin, dBFS */
+};
+
+/*
+ * Windowed, half overlapping FFTs of every channel on a thread of its
+ * own. Frames come in through a fixed size ring that drops frames when
+ * full, so the capture never waits for the analysis. All buffers are
+ * allocated up front. A window never spans a drop or a restart, the
+ * frames before it are discarded.
+ */
+class SpectrumAnalyzer
+{
+public:
+	SpectrumAnalyzer(int channels, int bits, int rate, int size = 8192);
+	~SpectrumAnalyzer();
+
+	/* Called from the capture side with one packed frame */
+	void push(const char * frame);
+	/* Called from the capture side when the stream restarts */
+	void reset();
+
+	void start();
+	void stop();
+
+	std::vector<ChannelAnalysis> results();
+	unsigned long dropped() const;
+
+private:
+	void run();
+	void analyze();
+	void measure(int ch, const float * power);
+
+	int channels_;
+	int bytes_;
+	int rate_;
+	int size_;
+	Fft fft_;
+
+	/* Single producer, single consumer ring of packed frames */
+	std::vector<char> ring_;
+	unsigned ring_frames_;
+	std::atomic<unsigned> head_;
+	std::atomic<unsigned> tail_;
+	std::atomic<unsigned long> dropped_;
+	/* Set for the first frame after a drop or reset() */
+	std::vector<char> ring_break_;
+	bool pending_break_;
+
+	std::vector<float> window_;
+	double window_power_;
+	std::vector<float> input_;	/* size_ samples per channel */
+	int filled_;
+	std::vector<float> re_;
+	std::vector<float> im_;
+	std::vector<float> power_;	/* Averaged, size_/2 per channel */
+	std::vector<float> sorted_;
+	bool averaged_;
+
+	std::thread thread_;
+	std::atomic<bool> running_;
+	std::mutex mutex_;
+	std::vector<ChannelAnalysis> results_;
+};
+#endif
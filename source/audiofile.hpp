@@ -0,0 +1,24 @@
+#ifndef AUDIOFILE_HPP_
+#define AUDIOFILE_HPP_
+
+#include <cstddef>
+
+/* Output file for decoded frames, packed little endian PCM in. */
+class AudioFile
+{
+public:
+	virtual ~AudioFile() {}
+
+	virtual size_t write(const void * buffer, int Nframes) = 0;
+	virtual int sampleRate() const = 0;
+	virtual int channelCount() const = 0;
+	virtual void level_db(double * db) = 0;
+	/* Mark length missing frames at frame. */
+	virtual void addGap(unsigned frame, unsigned length) = 0;
+	/*
+	 * Core (-1 = any) and real-time priority (0 = normal) for the
+	 * threads that write the file, if it has any.
+	 */
+	virtual void schedule(int cpu, int priority) {}
+};
+#endif
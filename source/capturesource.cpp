@@ -0,0 +1,113 @@
+#include <cstdlib>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "capturesource.hpp"
+
+static std::mutex event_mutex;
+static std::condition_variable event_cond;
+static bool event_pending = false;
+
+CaptureSource::CaptureSource(unsigned long long id)
+	:id_(id), failed_(false), on_data_(NULL), on_data_user_(NULL),
+	 on_error_(NULL), on_error_user_(NULL)
+{
+}
+
+CaptureSource::~CaptureSource()
+{
+}
+
+void CaptureSource::registerOnData(CaptureDataCallback callback,
+				   void * user_data)
+{
+	on_data_ = callback;
+	on_data_user_ = user_data;
+}
+
+void CaptureSource::registerOnError(CaptureErrorCallback callback,
+				    void * user_data)
+{
+	on_error_ = callback;
+	on_error_user_ = user_data;
+}
+
+bool CaptureSource::exhausted() const
+{
+	return false;
+}
+
+std::vector<unsigned> CaptureSource::supportedSampleRates()
+{
+	return std::vector<unsigned>(1, sampleRate());
+}
+
+bool CaptureSource::connected() const
+{
+	return true;
+}
+
+bool CaptureSource::live() const
+{
+	return true;
+}
+
+void CaptureSource::overrun()
+{
+	fail();
+}
+
+long long CaptureSource::skipped() const
+{
+	return -1;
+}
+
+unsigned long long CaptureSource::id() const
+{
+	return id_;
+}
+
+bool CaptureSource::failed() const
+{
+	return failed_;
+}
+
+void CaptureSource::clearError()
+{
+	failed_ = false;
+}
+
+bool CaptureSource::waitEvent(double seconds)
+{
+	std::unique_lock<std::mutex> lock(event_mutex);
+	event_cond.wait_for(lock, std::chrono::duration<double>(seconds),
+			    [] { return event_pending; });
+	bool ret = event_pending;
+	event_pending = false;
+	return ret;
+}
+
+void CaptureSource::notifyEvent()
+{
+	{
+		std::lock_guard<std::mutex> lock(event_mutex);
+		event_pending = true;
+	}
+	event_cond.notify_all();
+}
+
+void CaptureSource::deliver(unsigned char * data, unsigned length)
+{
+	if(on_data_)
+		on_data_(this, data, length, on_data_user_);
+	else
+		release(data);
+}
+
+void CaptureSource::fail()
+{
+	failed_ = true;
+	if(on_error_)
+		on_error_(this, on_error_user_);
+	notifyEvent();
+}
@@ -0,0 +1,77 @@
+#ifndef CAPTURESOURCE_HPP_
+#define CAPTURESOURCE_HPP_
+
+#include <atomic>
+#include <vector>
+
+class CaptureSource;
+
+/*
+ * Called for every buffer of logic samples (one byte per sample).
+ * The callee owns the buffer and gives it back with
+ * CaptureSource::release() when done with it.
+ */
+typedef void (*CaptureDataCallback)(CaptureSource * source,
+				    unsigned char * data, unsigned length,
+				    void * user_data);
+typedef void (*CaptureErrorCallback)(CaptureSource * source,
+				     void * user_data);
+
+class CaptureSource
+{
+public:
+	CaptureSource(unsigned long long id);
+	virtual ~CaptureSource();
+
+	void registerOnData(CaptureDataCallback callback, void * user_data);
+	void registerOnError(CaptureErrorCallback callback, void * user_data);
+
+	virtual void start() = 0;
+	virtual void stop() = 0;
+	virtual bool streaming() const = 0;
+	/* True when the source has nothing more to deliver. */
+	virtual bool exhausted() const;
+	virtual unsigned sampleRate() const = 0;
+	virtual void sampleRate(unsigned rate) = 0;
+	virtual std::vector<unsigned> supportedSampleRates();
+	virtual void release(unsigned char * data) = 0;
+	virtual const char * name() const = 0;
+	virtual bool connected() const;
+	/*
+	 * True when data is lost unless taken in time, false when the
+	 * data callback may block and the source waits (fast replay).
+	 */
+	virtual bool live() const;
+	/* The consumer could not keep up, report it like the device would. */
+	virtual void overrun();
+	/*
+	 * Logic samples the source skipped after errors so far, or -1
+	 * when it cannot tell (the device just resumes streaming).
+	 */
+	virtual long long skipped() const;
+
+	unsigned long long id() const;
+	/* Set when the source reported an error, until clearError(). */
+	bool failed() const;
+	void clearError();
+
+	/*
+	 * Wait up to seconds for a connect, disconnect or error of any
+	 * source. Returns true if something happened.
+	 */
+	static bool waitEvent(double seconds);
+	static void notifyEvent();
+
+protected:
+	void deliver(unsigned char * data, unsigned length);
+	void fail();
+
+private:
+	unsigned long long id_;
+	std::atomic<bool> failed_;
+	CaptureDataCallback on_data_;
+	void * on_data_user_;
+	CaptureErrorCallback on_error_;
+	void * on_error_user_;
+};
+#endif
@@ -0,0 +1,433 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <map>
+#include "fft.hpp"
+#include "compare.hpp"
+
+/* Frames of the preview used to find the offsets, about 22 s */
+#define COMPARE_PREVIEW_FRAMES (1 << 20)
+#define COMPARE_DECIMATION 16
+/* Frames compared per read */
+#define COMPARE_CHUNK 65536
+/* How far a resync looks for dropped or repeated frames */
+#define COMPARE_RESYNC_FRAMES 64
+/* Frames that have to match after a resync */
+#define COMPARE_MATCH_FRAMES 16
+/* Frames compared at the old offset after a failed resync */
+#define COMPARE_RETRY_FRAMES 4800
+#define COMPARE_MAX_EVENTS 10
+/* Frames kept before the last one asked for, a resync goes back */
+#define COMPARE_HISTORY (2 * COMPARE_RESYNC_FRAMES + COMPARE_MATCH_FRAMES)
+
+WavCompare::Stream::Stream(const string & fileName)
+	:wav_(fileName, "rb"), base_(0), filled_(0), end_(false)
+{
+	channels_ = wav_.channelCount();
+	int bits = wav_.bitsPerSample();
+	if(bits % 8 || bits < 8 || bits > 32 || channels_ < 1) {
+		fprintf(stderr, "Error: unsupported format in %s.\n",
+			fileName.c_str());
+		exit(1);
+	}
+	shift_ = 32 - bits;
+	planes_.resize(channels_);
+	for (int c = 0; c < channels_; c++)
+		planes_[c].resize(COMPARE_CHUNK + COMPARE_HISTORY);
+	fill_.resize(channels_);
+	view_.resize(channels_);
+	wav_.readAhead(true);
+}
+
+WavCompare::Stream::~Stream()
+{
+}
+
+WavFile & WavCompare::Stream::wav()
+{
+	return wav_;
+}
+
+int WavCompare::Stream::channels() const
+{
+	return channels_;
+}
+
+void WavCompare::Stream::rewind()
+{
+	wav_.rewind();
+	base_ = 0;
+	filled_ = 0;
+	end_ = false;
+}
+
+/* Read up to count more frames after the filled ones */
+unsigned WavCompare::Stream::fill(unsigned count)
+{
+	for (int c = 0; c < channels_; c++)
+		fill_[c] = &planes_[c][filled_];
+	unsigned n = wav_.read(&fill_[0], count);
+	if(n < count)
+		end_ = true;
+	/* Left align so that different widths compare */
+	for (int c = 0; c < channels_; c++) {
+		int * p = fill_[c];
+		for (unsigned i = 0; i < n; i++)
+			p[i] = (int) ((unsigned) p[i] << shift_);
+	}
+	return n;
+}
+
+const int * const * WavCompare::Stream::frames(unsigned long long first,
+					       unsigned count,
+					       unsigned * available)
+{
+	unsigned capacity = planes_[0].size();
+	if(first < base_ || count > COMPARE_CHUNK) {
+		fprintf(stderr, "Error: compare window out of range.\n");
+		exit(1);
+	}
+
+	/* Keep some history, frames before first may be asked for again */
+	if(first > base_ + COMPARE_HISTORY) {
+		unsigned long long drop = first - base_ - COMPARE_HISTORY;
+		if(drop > filled_)
+			drop = filled_;
+		for (int c = 0; c < channels_; c++)
+			memmove(&planes_[c][0], &planes_[c][drop],
+				sizeof(int) * (filled_ - drop));
+		base_ += drop;
+		filled_ -= drop;
+	}
+
+	/* Skipping ahead, nothing to keep */
+	while(!end_ && !filled_ && base_ < first) {
+		unsigned long long skip = first - base_;
+		base_ += fill(skip < COMPARE_CHUNK ? (unsigned) skip :
+			      COMPARE_CHUNK);
+	}
+
+	while(!end_ && base_ + filled_ < first + count) {
+		unsigned want = capacity - filled_;
+		if(want > COMPARE_CHUNK)
+			want = COMPARE_CHUNK;
+		filled_ += fill(want);
+	}
+
+	unsigned long long end = base_ + filled_;
+	if(first >= end) {
+		*available = 0;
+		return NULL;
+	}
+	*available = end - first < count ? (unsigned) (end - first) : count;
+	for (int c = 0; c < channels_; c++)
+		view_[c] = &planes_[c][first - base_];
+	return &view_[0];
+}
+
+WavCompare::WavCompare(const string & reference, const string & capture)
+	:reference_(reference), capture_(capture), tolerance_(0),
+	 compared_(0), bad_samples_(0), bad_frames_(0), first_found_(false),
+	 first_frame_(0), first_channel_(0), first_reference_(0),
+	 first_capture_(0), dropped_(0), repeated_(0), events_(0)
+{
+	channels_ = reference_.channels() < capture_.channels() ?
+		reference_.channels() : capture_.channels();
+	if(reference_.wav().sampleRate() != capture_.wav().sampleRate())
+		fprintf(stderr, "Warning: sample rates differ, %d and %d "
+			"Hz.\n", reference_.wav().sampleRate(),
+			capture_.wav().sampleRate());
+	tolerance(0);
+}
+
+WavCompare::~WavCompare()
+{
+}
+
+void WavCompare::tolerance(unsigned lsb)
+{
+	int bits = reference_.wav().bitsPerSample();
+	if(capture_.wav().bitsPerSample() < bits)
+		bits = capture_.wav().bitsPerSample();
+	tolerance_ = (long long) lsb << (32 - bits);
+}
+
+/* The first COMPARE_PREVIEW_FRAMES of every channel of a stream */
+void WavCompare::preview(Stream & stream, vector< vector<float> > * planes)
+{
+	planes->assign(stream.channels(), vector<float>());
+	stream.rewind();
+	unsigned long long f = 0;
+	while(f < COMPARE_PREVIEW_FRAMES) {
+		unsigned got;
+		const int * const * p = stream.frames(f, COMPARE_CHUNK, &got);
+		if(!p)
+			break;
+		for (int c = 0; c < stream.channels(); c++)
+			for (unsigned i = 0; i < got; i++)
+				(*planes)[c].push_back(p[c][i] *
+						       (1.0f / 2147483648.0f));
+		f += got;
+	}
+	stream.rewind();
+}
+
+/*
+ * Cross correlate the decimated previews of a channel, the lag is the
+ * capture frame of reference frame 0. False for a silent channel.
+ */
+bool WavCompare::find_offset(const vector<float> & full_ref,
+			     const vector<float> & full_cap, long long * lag)
+{
+	int n = COMPARE_PREVIEW_FRAMES / COMPARE_DECIMATION;
+	int size = 1;
+	while(size < 2 * n)
+		size <<= 1;
+	vector<float> ref_re(size, 0.0f), ref_im(size, 0.0f);
+	vector<float> cap_re(size, 0.0f), cap_im(size, 0.0f);
+
+	const vector<float> * full[2] = { &full_ref, &full_cap };
+	vector<float> * decimated[2] = { &ref_re, &cap_re };
+	for (int s = 0; s < 2; s++) {
+		double energy = 0;
+		for (size_t i = 0; i < full[s]->size(); i++) {
+			float v = (*full[s])[i];
+			(*decimated[s])[i / COMPARE_DECIMATION] += v;
+			energy += (double) v * v;
+		}
+		if(energy == 0)
+			return false;
+	}
+
+	/* corr[k] = sum cap[i + k] ref[i], by conj(FFT(ref)) FFT(cap) */
+	Fft fft(size);
+	fft.forward(&ref_re[0], &ref_im[0]);
+	fft.forward(&cap_re[0], &cap_im[0]);
+	for (int k = 0; k < size; k++) {
+		float re = cap_re[k] * ref_re[k] + cap_im[k] * ref_im[k];
+		float im = cap_im[k] * ref_re[k] - cap_re[k] * ref_im[k];
+		/* Conjugate in, conjugate out gives the inverse */
+		cap_re[k] = re;
+		cap_im[k] = -im;
+	}
+	fft.forward(&cap_re[0], &cap_im[0]);
+	int peak = 0;
+	for (int k = 1; k < size; k++)
+		if(cap_re[k] > cap_re[peak])
+			peak = k;
+	long long coarse = (peak < size / 2 ? peak : peak - size) *
+		(long long) COMPARE_DECIMATION;
+
+	/* Refine around the coarse lag at the full rate */
+	long long best = coarse;
+	double best_corr = -1e300;
+	long long nr = full_ref.size(), nc = full_cap.size();
+	for (long long l = coarse - COMPARE_DECIMATION;
+	     l <= coarse + COMPARE_DECIMATION; l++) {
+		double corr = 0;
+		long long from = l < 0 ? -l : 0;
+		long long to = nc - l < nr ? nc - l : nr;
+		for (long long i = from; i < to; i++)
+			corr += (double) full_ref[i] * full_cap[i + l];
+		if(corr > best_corr) {
+			best_corr = corr;
+			best = l;
+		}
+	}
+	*lag = best;
+	return true;
+}
+
+/* Mismatching samples of frame i */
+unsigned WavCompare::mismatches(const int * const * a, const int * const * b,
+				unsigned i)
+{
+	unsigned bad = 0;
+	for (int c = 0; c < channels_; c++) {
+		long long d = (long long) a[c][i] - b[c][i];
+		bad += (d > tolerance_) | (d < -tolerance_);
+	}
+	return bad;
+}
+
+/*
+ * First sample of a plane that differs more than the tolerance, n when
+ * none. Whole blocks are checked first in 32 bit lanes: instead of a
+ * 64 bit difference, a is compared against b -+ tolerance clamped to
+ * the int range, which gcc turns into SSE2 compares and selects. A
+ * tolerance above INT_MAX is clamped there, so a block may be flagged
+ * too early, the exact check below settles it.
+ */
+static unsigned first_difference(const int * a, const int * b, unsigned n,
+				 long long tolerance)
+{
+	const unsigned block = 64;
+	int t = tolerance > INT_MAX ? INT_MAX : (int) tolerance;
+	unsigned i = 0;
+	for (; i + block <= n; i += block) {
+		int bad = 0;
+		for (unsigned k = 0; k < block; k++) {
+			int lo = b[i + k] < INT_MIN + t ?
+				INT_MIN : b[i + k] - t;
+			int hi = b[i + k] > INT_MAX - t ?
+				INT_MAX : b[i + k] + t;
+			bad |= (a[i + k] < lo) | (a[i + k] > hi);
+		}
+		if(bad)
+			break;
+	}
+	for (; i < n; i++) {
+		long long d = (long long) a[i] - b[i];
+		if(d > tolerance || d < -tolerance)
+			break;
+	}
+	return i;
+}
+
+/* True when count frames from reference frame r match at the lag */
+bool WavCompare::match(unsigned long long r, long long lag, unsigned count)
+{
+	if((long long) r + lag < 0)
+		return false;
+	unsigned na, nb;
+	const int * const * a = reference_.frames(r, count, &na);
+	const int * const * b = capture_.frames(r + lag, count, &nb);
+	if(!a || !b || na < count || nb < count)
+		return false;
+	for (unsigned i = 0; i < count; i++)
+		if(mismatches(a, b, i))
+			return false;
+	return true;
+}
+
+void WavCompare::compare(long long lag)
+{
+	unsigned long long r = lag < 0 ? -lag : 0;
+	unsigned long long retry = 0;
+
+	for(;;) {
+		unsigned na, nb;
+		const int * const * a = reference_.frames(r, COMPARE_CHUNK,
+							   &na);
+		const int * const * b = capture_.frames(r + lag, COMPARE_CHUNK,
+							 &nb);
+		if(!a || !b)
+			break;
+		unsigned n = na < nb ? na : nb;
+
+		/* The earliest difference of all channels */
+		unsigned i = n;
+		for (int c = 0; c < channels_; c++)
+			i = first_difference(a[c], b[c], i, tolerance_);
+		compared_ += i;
+		if(i == n) {
+			r += n;
+			continue;
+		}
+
+		r += i;
+		unsigned bad = mismatches(a, b, i);
+		if(!first_found_) {
+			first_found_ = true;
+			first_frame_ = r;
+			for (int c = 0; c < channels_; c++) {
+				long long d = (long long) a[c][i] - b[c][i];
+				if(d > tolerance_ || d < -tolerance_) {
+					first_channel_ = c;
+					first_reference_ = a[c][i];
+					first_capture_ = b[c][i];
+					break;
+				}
+			}
+		}
+
+		/* A damaged frame, or did the capture lose step? */
+		bool resynced = false;
+		if(r >= retry && !match(r + 1, lag, COMPARE_MATCH_FRAMES)) {
+			/*
+			 * After d dropped frames the capture goes on with
+			 * reference frame r + d, after d repeated ones the
+			 * capture frame d later holds reference frame r.
+			 */
+			for (long long d = 1; d <= COMPARE_RESYNC_FRAMES &&
+				     !resynced; d++) {
+				bool drop = match(r + d, lag - d,
+						  COMPARE_MATCH_FRAMES);
+				if(!drop && !match(r, lag + d,
+						   COMPARE_MATCH_FRAMES))
+					continue;
+				if(events_ < COMPARE_MAX_EVENTS)
+					printf("Capture %s %lld frames at "
+					       "reference frame %llu.\n",
+					       drop ? "drops" : "repeats", d,
+					       r);
+				events_++;
+				if(drop) {
+					dropped_ += d;
+					lag -= d;
+					r += d;
+				} else {
+					repeated_ += d;
+					lag += d;
+				}
+				resynced = true;
+			}
+			if(!resynced)
+				retry = r + COMPARE_RETRY_FRAMES;
+		}
+		if(resynced)
+			continue;
+		bad_samples_ += bad;
+		bad_frames_++;
+		compared_++;
+		r++;
+	}
+}
+
+bool WavCompare::run()
+{
+	printf("Comparing %d channels, %d and %d bits.\n", channels_,
+	       reference_.wav().bitsPerSample(),
+	       capture_.wav().bitsPerSample());
+
+	/* The most common lag of the channels that are not silent */
+	vector< vector<float> > ref_preview, cap_preview;
+	preview(reference_, &ref_preview);
+	preview(capture_, &cap_preview);
+	std::map<long long, int> votes;
+	long long lag = 0;
+	int best = 0;
+	for (int c = 0; c < channels_; c++) {
+		long long l;
+		if(!find_offset(ref_preview[c], cap_preview[c], &l)) {
+			printf("Channel %d: silent.\n", c);
+			continue;
+		}
+		printf("Channel %d: capture offset %lld frames.\n", c, l);
+		if(++votes[l] > best) {
+			best = votes[l];
+			lag = l;
+		}
+	}
+	if(!best) {
+		printf("Nothing to compare, all channels are silent.\n");
+		return false;
+	}
+	if(votes.size() > 1)
+		printf("Channels disagree on the offset, using %lld.\n", lag);
+
+	compare(lag);
+
+	printf("Compared %llu frames: %llu samples in %llu frames "
+	       "differ.\n", compared_, bad_samples_, bad_frames_);
+	if(first_found_)
+		printf("First difference at reference frame %llu channel "
+		       "%d: %d, captured %d.\n", first_frame_, first_channel_,
+		       first_reference_ >> (32 - reference_.wav().bitsPerSample()),
+		       first_capture_ >> (32 - capture_.wav().bitsPerSample()));
+	if(events_)
+		printf("%lu resyncs, %llu frames dropped and %llu repeated.\n",
+		       events_, dropped_, repeated_);
+	return votes.size() == 1 && !bad_samples_ && !events_;
+}
@@ -0,0 +1,81 @@
+#ifndef COMPARE_HPP_
+#define COMPARE_HPP_
+
+#include <string>
+#include <vector>
+#include "wavfile.hpp"
+
+using namespace std;
+
+/*
+ * Checks a capture against the reference that was played into the
+ * device under test. The offset of every channel is found by FFT cross
+ * correlation of a decimated preview and refined at the full rate.
+ * The whole overlap is then compared, bit exact or within a tolerance,
+ * and when the capture loses step the comparison looks for dropped or
+ * repeated frames nearby to resync.
+ */
+class WavCompare
+{
+public:
+	WavCompare(const string & reference, const string & capture);
+	~WavCompare();
+
+	/* Allowed difference in LSBs of the coarser of the two formats */
+	void tolerance(unsigned lsb);
+	/* Print a report, true when the overlap matched without events. */
+	bool run();
+
+private:
+	/* Forward reading window of a file, planes 32 bit left aligned */
+	class Stream {
+	public:
+		Stream(const string & fileName);
+		~Stream();
+		/* Planes from frame first on, at most count, NULL at the end */
+		const int * const * frames(unsigned long long first,
+					   unsigned count,
+					   unsigned * available);
+		void rewind();
+		WavFile & wav();
+		int channels() const;
+	private:
+		WavFile wav_;
+		int channels_;
+		int shift_;
+		vector< vector<int> > planes_;
+		vector<int *> fill_;
+		vector<const int *> view_;
+		unsigned long long base_;
+		unsigned filled_;
+		bool end_;
+
+		unsigned fill(unsigned count);
+	};
+
+	void preview(Stream & stream, vector< vector<float> > * planes);
+	bool find_offset(const vector<float> & full_ref,
+			 const vector<float> & full_cap, long long * lag);
+	bool match(unsigned long long r, long long lag, unsigned count);
+	unsigned mismatches(const int * const * a, const int * const * b,
+			    unsigned i);
+	void compare(long long lag);
+
+	Stream reference_;
+	Stream capture_;
+	int channels_;
+	long long tolerance_;
+
+	unsigned long long compared_;
+	unsigned long long bad_samples_;
+	unsigned long long bad_frames_;
+	bool first_found_;
+	unsigned long long first_frame_;
+	int first_channel_;
+	int first_reference_;
+	int first_capture_;
+	unsigned long long dropped_;
+	unsigned long long repeated_;
+	unsigned long events_;
+};
+#endif
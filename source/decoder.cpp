@@ -0,0 +1,272 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include "decoder.hpp"
+
+#define NUM_ELEMENTS(array) (sizeof(array)/sizeof(array[0]))
+#define NO_POSITION (~0ULL)
+
+const I2sDecoder::protocol_transition I2sDecoder::state_machine_[] = {
+	//current_state,    mask,      match,  new state
+	{IDLE, 0x01, 0x01, FRAME_START, NULL},
+	{FRAME_START, 0x02, 0x02, FRAME_FIRST_BIT, NULL},
+	{FRAME_FIRST_BIT, 0x02, 0x00, FRAME_START,
+	 &I2sDecoder::handle_data_bit},
+	{FRAME_START, 0x01, 0x00, FRAME_ACTIVE, NULL},
+	{FRAME_ACTIVE, 0x02, 0x02, DATA_BIT_ACTIVE, NULL},
+	{DATA_BIT_ACTIVE, 0x02, 0x00, FRAME_ACTIVE,
+	 &I2sDecoder::handle_data_bit},
+	{FRAME_ACTIVE, 0x01, 0x01, FRAME_START,
+	 &I2sDecoder::handle_frame_end},
+};
+
+I2sDecoder::I2sDecoder(int bits, int channels, int wires)
+	:bits_(bits), channels_(channels), wires_(wires),
+	 current_state_(IDLE), current_channel_(0), current_bit_(0),
+	 group_(0), group_bits_(0), frames_(0), position_(0),
+	 frame_position_(0), on_frame_(NULL),
+	 on_frame_user_(NULL), on_timing_(NULL), on_timing_user_(NULL)
+{
+	if(bits_ % 8 || bits_ > 32 || wires_ < 1 || wires_ > MAX_WIRES){
+		fprintf(stderr, "Error: unsupported format, %d bits and "
+			"%d wires.\n", bits_, wires_);
+		exit(1);
+	}
+	channel_ = new int [wires_ * channels_];
+	frame_ = new char [frameSize()];
+	memset(channel_, 0, sizeof(int) * wires_ * channels_);
+	reset();
+
+	/* Only frame sync and bit clock matter for the state changes */
+	for (int s = 0; s < STATES; s++) {
+		for (int d = 0; d < 4; d++) {
+			next_[s][d] = -1;
+			for (unsigned i = 0; i < NUM_ELEMENTS(state_machine_);
+			     i++) {
+				const protocol_transition & t =
+					state_machine_[i];
+				if (t.current_state == s &&
+				    (d & t.mask) == t.match) {
+					next_[s][d] = i;
+					break;
+				}
+			}
+		}
+	}
+}
+
+I2sDecoder::~I2sDecoder()
+{
+	delete [] channel_;
+	delete [] frame_;
+}
+
+void I2sDecoder::registerOnFrame(FrameCallback callback, void * user_data)
+{
+	on_frame_ = callback;
+	on_frame_user_ = user_data;
+}
+
+void I2sDecoder::registerOnTiming(TimingCallback callback, void * user_data)
+{
+	on_timing_ = callback;
+	on_timing_user_ = user_data;
+}
+
+int I2sDecoder::bits() const
+{
+	return bits_;
+}
+
+int I2sDecoder::channelCount() const
+{
+	return wires_ * channels_;
+}
+
+int I2sDecoder::frameSize() const
+{
+	return channelCount() * bits_ / 8;
+}
+
+unsigned long I2sDecoder::frames() const
+{
+	return frames_;
+}
+
+unsigned long long I2sDecoder::position() const
+{
+	return position_;
+}
+
+unsigned long long I2sDecoder::framePosition() const
+{
+	return frame_position_;
+}
+
+void I2sDecoder::reset()
+{
+	current_state_ = IDLE;
+	current_channel_ = 0;
+	current_bit_ = 0;
+	group_ = 0;
+	group_bits_ = 0;
+	memset(channel_, 0, sizeof(int) * wires_ * channels_);
+	last_fs_ = NO_POSITION;
+	last_edge_ = NO_POSITION;
+	first_edge_ = NO_POSITION;
+	frame_edges_ = 0;
+	bit_min_ = 0;
+	bit_max_ = 0;
+}
+
+void I2sDecoder::seek(unsigned long long position)
+{
+	reset();
+	/* The frame sync that ended the previous frame was just seen */
+	current_state_ = FRAME_START;
+	position_ = position;
+	frame_position_ = position;
+	last_fs_ = position - 1;
+}
+
+void I2sDecoder::decode(const unsigned char * data, unsigned length)
+{
+	for (unsigned i = 0; i < length; i++) {
+		transition(data[i]);
+		position_++;
+	}
+}
+
+void I2sDecoder::handle_frame_end(int state_index, unsigned char data)
+{
+	/* Frames that are not a multiple of 8 bits leave a partial group */
+	if(group_bits_)
+		shift_bits();
+
+	int bytes = bits_ / 8;
+	int channel_count = channelCount();
+	for (int i = 0; i < channel_count; i++) {
+		for (int b = 0; b < bytes; b++)
+			frame_[i*bytes+b] = (channel_[i] >> (8*b)) & 0xff;
+	}
+
+	if(on_timing_)
+		frame_timing();
+
+	/* The next frame starts after this frame sync sample */
+	frame_position_ = position_ + 1;
+	frames_++;
+	if(on_frame_)
+		on_frame_(frame_, on_frame_user_);
+
+	current_channel_ = 0;
+	current_bit_ = 0;
+
+	memset(channel_, 0, sizeof(int) * channel_count);
+}
+
+/*
+ * Transpose the 8x8 bit matrix in group_ (sample i in byte 7-i) so
+ * that byte 2+w holds the eight bits of data wire w, first bit on top.
+ */
+static inline unsigned long long transpose8(unsigned long long x)
+{
+	unsigned long long t;
+	t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+	x = x ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+	x = x ^ t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+	x = x ^ t ^ (t << 28);
+	return x;
+}
+
+void I2sDecoder::shift_group()
+{
+	unsigned long long x = transpose8(group_);
+	int * ch = &channel_[current_channel_];
+	for (int w = 0; w < wires_; w++) {
+		/* Data wires start from bit 2 */
+		ch[w*channels_] = (int) (((unsigned) ch[w*channels_] << 8) |
+					 ((x >> (8*(2+w))) & 0xff));
+	}
+	group_bits_ = 0;
+
+	current_bit_ += 8;
+	if (current_bit_ == bits_) {
+		current_bit_ = 0;
+		current_channel_++;
+	}
+}
+
+void I2sDecoder::shift_bits()
+{
+	int * ch = &channel_[current_channel_];
+	for (int i = 0; i < group_bits_; i++) {
+		unsigned char data = (group_ >> (8*(group_bits_-1-i))) & 0xff;
+		for (int w = 0; w < wires_; w++) {
+			ch[w*channels_] <<= 1;
+			if (data & (0x01<<(2+w)))
+				ch[w*channels_] |= 1;
+		}
+	}
+	group_bits_ = 0;
+}
+
+void I2sDecoder::clock_edge()
+{
+	if(last_edge_ != NO_POSITION) {
+		unsigned period = (unsigned) (position_ - last_edge_);
+		if(!bit_min_ || period < bit_min_)
+			bit_min_ = period;
+		if(period > bit_max_)
+			bit_max_ = period;
+	}
+	if(!frame_edges_)
+		first_edge_ = position_;
+	last_edge_ = position_;
+	frame_edges_++;
+}
+
+void I2sDecoder::frame_timing()
+{
+	FrameTiming t;
+	t.position = position_;
+	t.fs_period = last_fs_ != NO_POSITION ?
+		(unsigned) (position_ - last_fs_) : 0;
+	t.bit_period = frame_edges_ > 1 ?
+		(double) (last_edge_ - first_edge_) / (frame_edges_ - 1) : 0;
+	t.bit_min = bit_min_;
+	t.bit_max = bit_max_;
+	t.phase = last_edge_ != NO_POSITION ?
+		(unsigned) (position_ - last_edge_) : 0;
+
+	last_fs_ = position_;
+	frame_edges_ = 0;
+	bit_min_ = 0;
+	bit_max_ = 0;
+	on_timing_(&t, on_timing_user_);
+}
+
+void I2sDecoder::handle_data_bit(int state_index, unsigned char data)
+{
+	if(on_timing_)
+		clock_edge();
+	if(current_channel_ < channels_){
+		group_ = (group_ << 8) | data;
+		if (++group_bits_ == 8)
+			shift_group();
+	}
+}
+
+void I2sDecoder::transition(unsigned char data)
+{
+	int i = next_[current_state_][data & 0x03];
+	if (i >= 0) {
+		const protocol_transition & t = state_machine_[i];
+		if (t.transition) {
+			(this->*t.transition)(i, data);
+		}
+		current_state_ = t.new_state;
+	}
+}
@@ -0,0 +1,122 @@
+#ifndef DECODER_HPP_
+#define DECODER_HPP_
+
+/*
+ * Called with every decoded TDM frame: channels * wires little endian
+ * samples of bits/8 bytes each, wire by wire.
+ */
+typedef void (*FrameCallback)(const char * frame, void * user_data);
+
+/* Clock timing of a frame, in logic samples */
+struct FrameTiming {
+	/* Logic sample of the frame sync that ended the frame */
+	unsigned long long position;
+	/* From the previous frame sync, 0 when not known */
+	unsigned fs_period;
+	/* Mean, shortest and longest bit clock period in the frame */
+	double bit_period;
+	unsigned bit_min;
+	unsigned bit_max;
+	/* From the last bit clock falling edge to the frame sync */
+	unsigned phase;
+};
+
+typedef void (*TimingCallback)(const FrameTiming * timing, void * user_data);
+
+/*
+ * Decodes TDM DSP mode B from logic samples.
+ * Logic wiring: bit 0 frame sync, bit 1 bit clock, bit 2.. data wires.
+ *
+ * The logic samples taken at bit clock edges are gathered eight at a
+ * time and bit-transposed, which gives a whole byte for every data
+ * wire at once. The cost per bit hardly depends on the number of wires.
+ */
+class I2sDecoder
+{
+public:
+	static const int MAX_WIRES = 6;
+
+	/* bits per slot must be a multiple of 8 */
+	I2sDecoder(int bits, int channels, int wires);
+	~I2sDecoder();
+
+	void registerOnFrame(FrameCallback callback, void * user_data);
+	/* Measure the clocks, which costs a little per bit when enabled. */
+	void registerOnTiming(TimingCallback callback, void * user_data);
+	void decode(const unsigned char * data, unsigned length);
+	/* Forget the partial frame and wait for the next frame sync. */
+	void reset();
+	/*
+	 * Continue at a frame boundary taken from framePosition(), the
+	 * data given next starts at that byte of the logic stream.
+	 */
+	void seek(unsigned long long position);
+
+	int bits() const;
+	int channelCount() const;
+	int frameSize() const;
+	unsigned long frames() const;
+	/* Logic bytes decoded */
+	unsigned long long position() const;
+	/* Where the frame after the last completed one starts */
+	unsigned long long framePosition() const;
+
+private:
+	enum protocol_state {
+		IDLE,
+		FRAME_START,
+		FRAME_FIRST_BIT,
+		FRAME_ACTIVE,
+		DATA_BIT_ACTIVE,
+		STATES
+	};
+
+	struct protocol_transition {
+		protocol_state current_state;
+		unsigned char mask;
+		unsigned char match;
+		protocol_state new_state;
+		void (I2sDecoder::*transition)(int state_index,
+					       unsigned char data);
+	};
+
+	static const protocol_transition state_machine_[];
+
+	void transition(unsigned char data);
+	void handle_data_bit(int state_index, unsigned char data);
+	void handle_frame_end(int state_index, unsigned char data);
+	void shift_group();
+	void shift_bits();
+	void clock_edge();
+	void frame_timing();
+
+	int bits_;
+	int channels_;
+	int wires_;
+	protocol_state current_state_;
+	int * channel_;
+	char * frame_;
+	int current_channel_;
+	int current_bit_;
+	/* Index of the matching state_machine_ row by state, FS and BCLK */
+	signed char next_[STATES][4];
+	/* Data samples of the current group, first one in the top byte */
+	unsigned long long group_;
+	int group_bits_;
+	unsigned long frames_;
+	unsigned long long position_;
+	unsigned long long frame_position_;
+	FrameCallback on_frame_;
+	void * on_frame_user_;
+
+	/* Timing, positions are ~0 when not seen since the last reset */
+	TimingCallback on_timing_;
+	void * on_timing_user_;
+	unsigned long long last_fs_;
+	unsigned long long last_edge_;
+	unsigned long long first_edge_;
+	unsigned frame_edges_;
+	unsigned bit_min_;
+	unsigned bit_max_;
+};
+#endif
@@ -0,0 +1,261 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(WIN32)
+ #include <io.h>
+ #include <malloc.h>
+#else
+ #include <unistd.h>
+#endif
+#include "affinity.hpp"
+#include "directwriter.hpp"
+
+/*
+ * A raw dump passes 2 GiB after 90 s at 24 MHz. pwrite() and
+ * ftruncate() take an off_t, in a 32 bit build that needs
+ * -D_FILE_OFFSET_BITS=64 (see build_project.py), which also opens the
+ * file with O_LARGEFILE.
+ */
+#if !defined(WIN32)
+static_assert(sizeof(off_t) >= 8, "build with -D_FILE_OFFSET_BITS=64");
+#endif
+
+static unsigned char * aligned_alloc_buffer(size_t size)
+{
+#if defined(WIN32)
+	return (unsigned char *) _aligned_malloc(size,
+						 DirectWriter::ALIGNMENT);
+#else
+	void * p = NULL;
+	if(posix_memalign(&p, DirectWriter::ALIGNMENT, size))
+		return NULL;
+	return (unsigned char *) p;
+#endif
+}
+
+static void aligned_free_buffer(unsigned char * p)
+{
+#if defined(WIN32)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+DirectWriter::DirectWriter(const string & fileName, size_t bufferSize,
+			   int buffers)
+	:file_name_(fileName), fd_(-1), direct_(false), current_(NULL),
+	 offset_(0), written_(0), in_flight_(0), max_in_flight_(0),
+	 stalls_(0), running_(true)
+{
+	buffer_size_ = (bufferSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+#if defined(WIN32)
+	fd_ = _open(file_name_.c_str(),
+		    _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+		    _S_IREAD | _S_IWRITE);
+#else
+ #if defined(O_DIRECT)
+	fd_ = open(file_name_.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+		   O_DIRECT, 0644);
+	direct_ = fd_ >= 0;
+ #endif
+	/* tmpfs and some network file systems have no direct I/O */
+	if(fd_ < 0)
+		fd_ = open(file_name_.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+			   0644);
+ #if defined(F_NOCACHE)
+	if(fd_ >= 0)
+		direct_ = fcntl(fd_, F_NOCACHE, 1) == 0;
+ #endif
+#endif
+	if(fd_ < 0){
+		fprintf(stderr, "Error opening filename: %s.\n",
+			file_name_.c_str());
+		exit(1);
+	}
+
+	pool_.resize(buffers < 2 ? 2 : buffers);
+	for (size_t i = 0; i < pool_.size(); i++) {
+		pool_[i].data = aligned_alloc_buffer(buffer_size_);
+		if(!pool_[i].data){
+			fprintf(stderr, "Error: out of memory.\n");
+			exit(1);
+		}
+		/* Fault the pages in now, not in the middle of a capture */
+		memset(pool_[i].data, 0, buffer_size_);
+		pool_[i].length = 0;
+		pool_[i].offset = 0;
+		free_.push_back(&pool_[i]);
+	}
+	current_ = free_.front();
+	free_.pop_front();
+	thread_ = thread(&DirectWriter::work, this);
+}
+
+DirectWriter::~DirectWriter()
+{
+	close();
+	for (size_t i = 0; i < pool_.size(); i++)
+		aligned_free_buffer(pool_[i].data);
+}
+
+size_t DirectWriter::write(const void * data, size_t length)
+{
+	const unsigned char * p = (const unsigned char *) data;
+	size_t left = length;
+	while(current_ && left) {
+		size_t n = buffer_size_ - current_->length;
+		if(n > left)
+			n = left;
+		memcpy(current_->data + current_->length, p, n);
+		current_->length += n;
+		p += n;
+		left -= n;
+		if(current_->length == buffer_size_)
+			submit();
+	}
+	written_ += length - left;
+	return length - left;
+}
+
+/* Hand the current buffer to the writer and take a free one. */
+void DirectWriter::submit()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	current_->offset = offset_;
+	offset_ += current_->length;
+	in_flight_ += current_->length;
+	if(in_flight_ > max_in_flight_)
+		max_in_flight_ = in_flight_;
+	queue_.push_back(current_);
+	work_.notify_one();
+
+	if(free_.empty())
+		stalls_++;
+	while(free_.empty() && running_)
+		done_.wait(lock);
+	current_ = NULL;
+	if(!free_.empty()) {
+		current_ = free_.front();
+		free_.pop_front();
+		current_->length = 0;
+	}
+}
+
+void DirectWriter::work()
+{
+	for(;;) {
+		Buffer * buffer;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			while(running_ && queue_.empty())
+				work_.wait(lock);
+			if(queue_.empty())
+				break;
+			buffer = queue_.front();
+			queue_.pop_front();
+		}
+
+		/* Direct I/O only takes whole blocks, close() truncates */
+		size_t length = buffer->length;
+		if(direct_)
+			length = (length + ALIGNMENT - 1) / ALIGNMENT *
+				ALIGNMENT;
+		memset(buffer->data + buffer->length, 0,
+		       length - buffer->length);
+		size_t done = 0;
+		while(done < length) {
+#if defined(WIN32)
+			int n = _write(fd_, buffer->data + done,
+				       (unsigned) (length - done));
+#else
+			ssize_t n = pwrite(fd_, buffer->data + done,
+					   length - done,
+					   (off_t) (buffer->offset + done));
+#endif
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0){
+				fprintf(stderr, "Error writing %s: %s.\n",
+					file_name_.c_str(), strerror(errno));
+				exit(1);
+			}
+			done += n;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			in_flight_ -= buffer->length;
+			free_.push_back(buffer);
+		}
+		done_.notify_one();
+	}
+}
+
+void DirectWriter::close()
+{
+	if(fd_ < 0)
+		return;
+	if(current_ && current_->length)
+		submit();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		running_ = false;
+	}
+	work_.notify_one();
+	done_.notify_all();
+	if(thread_.joinable())
+		thread_.join();
+
+#if defined(WIN32)
+	_chsize_s(fd_, (__int64) written_);
+	_close(fd_);
+#else
+	if(ftruncate(fd_, (off_t) written_))
+		fprintf(stderr, "Error truncating %s.\n", file_name_.c_str());
+	::close(fd_);
+#endif
+	fd_ = -1;
+	current_ = NULL;
+}
+
+void DirectWriter::schedule(int cpu, int priority)
+{
+	if(!thread_.joinable())
+		return;
+	if(cpu >= 0 && !pin_thread(thread_, cpu))
+		fprintf(stderr, "Could not pin the writer of %s to core %d.\n",
+			file_name_.c_str(), cpu);
+	if(priority > 0 && !realtime_thread(thread_, priority))
+		fprintf(stderr, "Could not raise the priority of the writer "
+			"of %s.\n", file_name_.c_str());
+}
+
+bool DirectWriter::direct() const
+{
+	return direct_;
+}
+
+unsigned long long DirectWriter::written() const
+{
+	return written_;
+}
+
+unsigned long long DirectWriter::inFlight() const
+{
+	return in_flight_;
+}
+
+unsigned long long DirectWriter::maxInFlight() const
+{
+	return max_in_flight_;
+}
+
+unsigned long DirectWriter::stalls() const
+{
+	return stalls_;
+}
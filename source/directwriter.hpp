@@ -0,0 +1,78 @@
+#ifndef DIRECTWRITER_HPP_
+#define DIRECTWRITER_HPP_
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+using namespace std;
+
+/*
+ * Sequential file writer that bypasses the page cache. Data is copied
+ * into a pool of aligned buffers and a thread of its own writes the
+ * full ones with O_DIRECT (F_NOCACHE on OS X), so a long capture does
+ * not leave gigabytes of dirty pages to be flushed at random moments.
+ * When the pool runs dry write() waits for the disk. Where the file
+ * system refuses direct I/O it quietly falls back to buffered writes.
+ */
+class DirectWriter
+{
+public:
+	/* Direct I/O wants offsets, sizes and memory on this boundary */
+	static const size_t ALIGNMENT = 4096;
+
+	DirectWriter(const string & fileName, size_t bufferSize = 1 << 20,
+		     int buffers = 8);
+	~DirectWriter();
+
+	size_t write(const void * data, size_t length);
+	/* Write what is left and cut the file to its real length. */
+	void close();
+	/* Core (-1 = any) and real-time priority (0 = normal) of the writer */
+	void schedule(int cpu, int priority);
+
+	bool direct() const;
+	/* Bytes given to write() */
+	unsigned long long written() const;
+	/* Bytes handed to the writer thread and not on disk yet */
+	unsigned long long inFlight() const;
+	unsigned long long maxInFlight() const;
+	/* How often write() had to wait for a free buffer */
+	unsigned long stalls() const;
+
+private:
+	struct Buffer {
+		unsigned char * data;
+		size_t length;
+		unsigned long long offset;
+	};
+
+	void submit();
+	void work();
+
+	const string file_name_;
+	int fd_;
+	bool direct_;
+	size_t buffer_size_;
+	vector<Buffer> pool_;
+	deque<Buffer *> free_;
+	deque<Buffer *> queue_;
+	Buffer * current_;
+	/* File offset of current_ */
+	unsigned long long offset_;
+	unsigned long long written_;
+	atomic<unsigned long long> in_flight_;
+	unsigned long long max_in_flight_;
+	unsigned long stalls_;
+
+	thread thread_;
+	mutex mutex_;
+	condition_variable work_;
+	condition_variable done_;
+	bool running_;
+};
+#endif
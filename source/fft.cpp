@@ -0,0 +1,98 @@
+#define _USE_MATH_DEFINES
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include "fft.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FFT_SSE 1
+#endif
+
+/* a += w b and b = a - w b for j < m, the old a on the right */
+static void butterflies(float * ar, float * ai, float * br, float * bi,
+			const float * wr, const float * wi, int m)
+{
+	int j = 0;
+#ifdef FFT_SSE
+	for (; j + 4 <= m; j += 4) {
+		__m128 xr = _mm_loadu_ps(br + j);
+		__m128 xi = _mm_loadu_ps(bi + j);
+		__m128 cr = _mm_loadu_ps(wr + j);
+		__m128 ci = _mm_loadu_ps(wi + j);
+		__m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+		__m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+		__m128 yr = _mm_loadu_ps(ar + j);
+		__m128 yi = _mm_loadu_ps(ai + j);
+		_mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+		_mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+		_mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+		_mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+	}
+#endif
+	for (; j < m; j++) {
+		float tr = br[j] * wr[j] - bi[j] * wi[j];
+		float ti = br[j] * wi[j] + bi[j] * wr[j];
+		br[j] = ar[j] - tr;
+		bi[j] = ai[j] - ti;
+		ar[j] += tr;
+		ai[j] += ti;
+	}
+}
+
+Fft::Fft(int n)
+	:n_(n), bitrev_(n)
+{
+	int bits = 0;
+	while((1 << bits) < n_)
+		bits++;
+	if((1 << bits) != n_) {
+		fprintf(stderr, "Error: FFT size %d is not a power of two.\n",
+			n_);
+		exit(1);
+	}
+
+	for (int i = 0; i < n_; i++) {
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		bitrev_[i] = r;
+	}
+
+	/* Stage with half size m uses exp(-2 pi i j / 2m), j < m */
+	for (int m = 1; m < n_; m <<= 1) {
+		for (int j = 0; j < m; j++) {
+			double a = -M_PI * j / m;
+			cos_.push_back((float) cos(a));
+			sin_.push_back((float) sin(a));
+		}
+	}
+}
+
+int Fft::size() const
+{
+	return n_;
+}
+
+void Fft::forward(float * re, float * im) const
+{
+	for (int i = 0; i < n_; i++) {
+		int r = bitrev_[i];
+		if(r > i) {
+			std::swap(re[i], re[r]);
+			std::swap(im[i], im[r]);
+		}
+	}
+
+	const float * wr = &cos_[0];
+	const float * wi = &sin_[0];
+	for (int m = 1; m < n_; m <<= 1) {
+		for (int k = 0; k < n_; k += 2 * m)
+			butterflies(re + k, im + k, re + k + m, im + k + m,
+				    wr, wi, m);
+		wr += m;
+		wi += m;
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef FFT_HPP_
+#define FFT_HPP_
+
+#include <vector>
+
+/*
+ * In-place radix-2 complex FFT on split real/imaginary arrays. The
+ * bit reversal and the twiddles of every stage are computed once, the
+ * twiddles stage by stage in order so the butterflies walk memory
+ * linearly. Where SSE is available (-msse2 in build_project.py, the
+ * default for MSVC) the stages from a half size of 4 on do four
+ * butterflies at a time, the first two stages and other targets are
+ * scalar.
+ */
+class Fft
+{
+public:
+	/* n must be a power of two */
+	Fft(int n);
+
+	void forward(float * re, float * im) const;
+	int size() const;
+
+private:
+	int n_;
+	std::vector<int> bitrev_;
+	std::vector<float> cos_;
+	std::vector<float> sin_;
+};
+#endif
@@ -0,0 +1,680 @@
+#include <cstdlib>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <sstream>
+#include "affinity.hpp"
+#include "flacfile.hpp"
+
+/* Room kept after STREAMINFO for the Vorbis comments written at close */
+#define FLAC_METADATA_SIZE 8192
+#define FLAC_MAX_PARTITION_ORDER 8
+#define FLAC_MAX_FIXED_ORDER 4
+#define FLAC_VENDOR "saleae_i2s_logger"
+
+/* Big endian bit writer for frames */
+class BitWriter
+{
+public:
+	BitWriter(vector<unsigned char> & out) :mOut(out), mAcc(0), mBits(0) {}
+
+	void put(unsigned value, int bits)
+	{
+		if(bits > 24) {
+			put(value >> 16, bits - 16);
+			put(value & 0xffff, 16);
+			return;
+		}
+		mAcc = (mAcc << bits) | (value & ((1ULL << bits) - 1));
+		mBits += bits;
+		while(mBits >= 8) {
+			mBits -= 8;
+			mOut.push_back((unsigned char) (mAcc >> mBits));
+		}
+	}
+
+	void zeros(unsigned count)
+	{
+		while(count >= 16) {
+			put(0, 16);
+			count -= 16;
+		}
+		put(0, count);
+	}
+
+	void align()
+	{
+		if(mBits)
+			put(0, 8 - mBits);
+	}
+
+private:
+	vector<unsigned char> & mOut;
+	unsigned long long mAcc;
+	int mBits;
+};
+
+static unsigned char crc8(const unsigned char * p, size_t n)
+{
+	unsigned char crc = 0;
+	while(n--) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+static struct Crc16Table {
+	unsigned short table[256];
+	Crc16Table()
+	{
+		for (int i = 0; i < 256; i++) {
+			unsigned short c = i << 8;
+			for (int j = 0; j < 8; j++)
+				c = (c & 0x8000) ? (c << 1) ^ 0x8005 : c << 1;
+			table[i] = c;
+		}
+	}
+} crc16_table;
+
+static unsigned short crc16(const unsigned char * p, size_t n)
+{
+	unsigned short crc = 0;
+	while(n--)
+		crc = (crc << 8) ^ crc16_table.table[(crc >> 8) ^ *p++];
+	return crc;
+}
+
+/* Residual of the fixed polynomial predictor of order */
+static inline int fixed_residual(const int * x, int i, int order)
+{
+	switch(order) {
+	case 0: return x[i];
+	case 1: return x[i] - x[i-1];
+	case 2: return x[i] - 2*x[i-1] + x[i-2];
+	case 3: return x[i] - 3*x[i-1] + 3*x[i-2] - x[i-3];
+	default: return x[i] - 4*x[i-1] + 6*x[i-2] - 4*x[i-3] + x[i-4];
+	}
+}
+
+static inline unsigned zigzag(int r)
+{
+	return ((unsigned) r << 1) ^ (unsigned) (r >> 31);
+}
+
+/* Rice parameter and estimated size in bits for a partition */
+static int rice_parameter(unsigned long long sum, unsigned count,
+			  unsigned long long * bits)
+{
+	int k = 0;
+	while(k < 30 && ((unsigned long long) count << (k + 1)) <= sum)
+		k++;
+	*bits = (unsigned long long) count * (k + 1) + (sum >> k);
+	return k;
+}
+
+static void encode_subframe(BitWriter & bw, const int * x, int n, int bps)
+{
+	bool constant = true;
+	for (int i = 1; i < n && constant; i++)
+		constant = x[i] == x[0];
+	if(constant) {
+		bw.put(0x00, 8);
+		bw.put((unsigned) x[0], bps);
+		return;
+	}
+
+	/* Pick the fixed predictor with the smallest residual */
+	int max_order = n > FLAC_MAX_FIXED_ORDER ? FLAC_MAX_FIXED_ORDER : n - 1;
+	int order = 0;
+	unsigned long long best = ~0ULL;
+	for (int o = 0; o <= max_order; o++) {
+		unsigned long long sum = 0;
+		for (int i = max_order; i < n; i++)
+			sum += (unsigned) abs(fixed_residual(x, i, o));
+		if(sum < best) {
+			best = sum;
+			order = o;
+		}
+	}
+
+	vector<unsigned> u(n, 0);
+	for (int i = order; i < n; i++)
+		u[i] = zigzag(fixed_residual(x, i, order));
+
+	/* Finest partition sums, coarser ones are added up from them */
+	int max_porder = 0;
+	while(max_porder < FLAC_MAX_PARTITION_ORDER &&
+	      (n >> (max_porder + 1)) << (max_porder + 1) == n &&
+	      (n >> (max_porder + 1)) > order)
+		max_porder++;
+	vector<unsigned long long> sums(1 << max_porder, 0);
+	int plen = n >> max_porder;
+	for (int p = 0; p < (1 << max_porder); p++)
+		for (int i = p * plen; i < (p + 1) * plen; i++)
+			sums[p] += u[i];
+
+	int porder = max_porder;
+	unsigned long long rice_bits = ~0ULL;
+	for (int po = max_porder; po >= 0; po--) {
+		int parts = 1 << po;
+		unsigned long long bits = 0;
+		for (int p = 0; p < parts; p++) {
+			unsigned count = (n >> po) - (p == 0 ? order : 0);
+			unsigned long long pbits;
+			rice_parameter(sums[p], count, &pbits);
+			bits += pbits + 5;
+		}
+		if(bits < rice_bits) {
+			rice_bits = bits;
+			porder = po;
+		}
+		for (int p = 0; p < parts / 2; p++)
+			sums[p] = sums[2*p] + sums[2*p+1];
+	}
+
+	if((unsigned long long) order * bps + 6 + rice_bits >=
+	   (unsigned long long) n * bps) {
+		bw.put(0x02, 8);	/* VERBATIM */
+		for (int i = 0; i < n; i++)
+			bw.put((unsigned) x[i], bps);
+		return;
+	}
+
+	bw.put(0x10 | (order << 1), 8);	/* FIXED */
+	for (int i = 0; i < order; i++)
+		bw.put((unsigned) x[i], bps);
+
+	int parts = 1 << porder;
+	plen = n >> porder;
+	vector<int> params(parts);
+	int max_param = 0;
+	for (int p = 0; p < parts; p++) {
+		unsigned long long sum = 0;
+		int start = p == 0 ? order : p * plen;
+		for (int i = start; i < (p + 1) * plen; i++)
+			sum += u[i];
+		unsigned long long bits;
+		params[p] = rice_parameter(sum, (p + 1) * plen - start, &bits);
+		if(params[p] > max_param)
+			max_param = params[p];
+	}
+	/* RICE2 has 5 bit parameters for wide residuals */
+	int rice2 = max_param > 14;
+	bw.put(rice2, 2);
+	bw.put(porder, 4);
+	for (int p = 0; p < parts; p++) {
+		int k = params[p];
+		bw.put(k, rice2 ? 5 : 4);
+		int start = p == 0 ? order : p * plen;
+		for (int i = start; i < (p + 1) * plen; i++) {
+			bw.zeros(u[i] >> k);
+			bw.put(1, 1);
+			if(k)
+				bw.put(u[i], k);
+		}
+	}
+}
+
+static void encode_frame(vector<unsigned char> & out, unsigned long number,
+			 const int * samples, int frames, int channels,
+			 int bps)
+{
+	BitWriter bw(out);
+	bw.put(0xfff8, 16);	/* sync, fixed block size */
+	bw.put(frames == FlacFile::BLOCK_SIZE ? 0xc : 0x7, 4);
+	bw.put(0x0, 4);		/* sample rate from STREAMINFO */
+	bw.put(channels - 1, 4);
+	bw.put(bps == 8 ? 0x1 : bps == 16 ? 0x4 : bps == 24 ? 0x6 : 0x0, 3);
+	bw.put(0, 1);
+
+	/* Frame number, UTF-8 style */
+	if(number < 0x80) {
+		bw.put(number, 8);
+	} else {
+		int bytes = number < 0x800 ? 2 : number < 0x10000 ? 3 :
+			number < 0x200000 ? 4 : number < 0x4000000 ? 5 : 6;
+		bw.put(((0xff << (8 - bytes)) & 0xff) |
+		       (number >> (6 * (bytes - 1))), 8);
+		for (int i = bytes - 2; i >= 0; i--)
+			bw.put(0x80 | ((number >> (6 * i)) & 0x3f), 8);
+	}
+	if(frames != FlacFile::BLOCK_SIZE)
+		bw.put(frames - 1, 16);
+	bw.put(crc8(&out[0], out.size()), 8);
+
+	for (int c = 0; c < channels; c++)
+		encode_subframe(bw, &samples[c * FlacFile::BLOCK_SIZE], frames,
+				bps);
+	bw.align();
+	bw.put(crc16(&out[0], out.size()), 16);
+}
+
+/* MD5 of the PCM, for decoders to verify the stream */
+static const unsigned int md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+	0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+	0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+	0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+	0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+	0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const int md5_r[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static void md5_block(unsigned int * h, const unsigned char * p)
+{
+	unsigned int w[16];
+	for (int i = 0; i < 16; i++)
+		w[i] = p[4*i] | p[4*i+1] << 8 | p[4*i+2] << 16 |
+			(unsigned int) p[4*i+3] << 24;
+	unsigned int a = h[0], b = h[1], c = h[2], d = h[3];
+	for (int i = 0; i < 64; i++) {
+		unsigned int f;
+		int g;
+		if(i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if(i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) % 16;
+		} else if(i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) % 16;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) % 16;
+		}
+		unsigned int t = d;
+		d = c;
+		c = b;
+		unsigned int x = a + f + md5_k[i] + w[g];
+		b = b + ((x << md5_r[i]) | (x >> (32 - md5_r[i])));
+		a = t;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+}
+
+static void md5_update(unsigned int * h, unsigned char * buffer,
+		       unsigned long long * length, const unsigned char * p,
+		       size_t n)
+{
+	size_t used = *length % 64;
+	*length += n;
+	if(used) {
+		size_t take = 64 - used < n ? 64 - used : n;
+		memcpy(buffer + used, p, take);
+		p += take;
+		n -= take;
+		if(used + take < 64)
+			return;
+		md5_block(h, buffer);
+	}
+	for (; n >= 64; n -= 64, p += 64)
+		md5_block(h, p);
+	memcpy(buffer, p, n);
+}
+
+static void md5_final(unsigned int * h, unsigned char * buffer,
+		      unsigned long long length, unsigned char * digest)
+{
+	unsigned long long bits = length * 8;
+	unsigned char pad[72] = { 0x80 };
+	size_t padlen = (length % 64 < 56 ? 56 : 120) - length % 64;
+	for (int i = 0; i < 8; i++)
+		pad[padlen + i] = (bits >> (8 * i)) & 0xff;
+	md5_update(h, buffer, &length, pad, padlen + 8);
+	for (int i = 0; i < 16; i++)
+		digest[i] = (h[i / 4] >> (8 * (i % 4))) & 0xff;
+}
+
+FlacFile::FlacFile(const string & fileName, int threads)
+	:mFileName(fileName), mSampleRate(48000), mNumChannels(1),
+	 mBitsPerSample(16), mThreadCount(threads > 0 ? threads : 1),
+	 mCpu(-1), mPriority(0), mStarted(false), mBlock(NULL), mBlocks(0), mFrames(0),
+	 mMinFrameSize(0), mMaxFrameSize(0), mLevels(NULL), mNextEncode(0),
+	 mNextWrite(0), mRunning(false)
+{
+	mFid = fopen(mFileName.c_str(), "wb");
+	if(!mFid){
+		fprintf(stderr, "Error opening filename: %s.\n",
+			mFileName.c_str());
+		exit(1);
+	}
+
+	static const unsigned int md5_init[4] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+	};
+	memcpy(mMd5.state, md5_init, sizeof(md5_init));
+	mMd5.length = 0;
+}
+
+FlacFile::~FlacFile()
+{
+	begin();
+	if(mBlock->frames)
+		submit();
+	delete mBlock;
+
+	{
+		unique_lock<mutex> lock(mMutex);
+		while(mNextWrite != mBlocks)
+			mDone.wait(lock);
+		mRunning = false;
+	}
+	mWork.notify_all();
+	for (size_t i = 0; i < mThreads.size(); i++)
+		mThreads[i].join();
+	for (size_t i = 0; i < mFree.size(); i++)
+		delete mFree[i];
+
+	write_metadata(true);
+	fclose(mFid);
+	delete [] mLevels;
+}
+
+bool FlacFile::supports(int channels, int bits)
+{
+	return (bits == 8 || bits == 16 || bits == 24) &&
+		channels >= 1 && channels <= MAX_CHANNELS;
+}
+
+void FlacFile::begin()
+{
+	if(mStarted)
+		return;
+	/* Main checks this before capturing, see supports() */
+	if(!supports(mNumChannels, mBitsPerSample)) {
+		fprintf(stderr, "Error: FLAC supports up to %d channels of "
+			"8, 16 or 24 bits.\n", MAX_CHANNELS);
+		exit(1);
+	}
+	mStarted = true;
+	mLevels = new float [mNumChannels];
+	for (int i = 0; i < mNumChannels; i++)
+		mLevels[i] = 0;
+
+	/* Placeholder, the real values are known at close */
+	write_metadata(false);
+
+	/*
+	 * submit() lets at most this many blocks wait for the encoders
+	 * or the write, one more is being filled. Touch them all now.
+	 */
+	size_t window = (size_t) mThreadCount * 4;
+	size_t data_size = (size_t) BLOCK_SIZE * mNumChannels *
+		(mBitsPerSample / 8) + mNumChannels + 32;
+	mSlots.assign(window, NULL);
+	for (size_t i = 0; i <= window; i++) {
+		Block * block = new Block;
+		block->samples.resize(BLOCK_SIZE * mNumChannels);
+		block->data.resize(data_size);
+		block->data.clear();
+		mFree.push_back(block);
+	}
+	mBlock = take();
+
+	mRunning = true;
+	for (int i = 0; i < mThreadCount; i++) {
+		mThreads.push_back(thread(&FlacFile::work, this));
+		/* The encoders share the writer core of the device */
+		if(mCpu >= 0 && !pin_thread(mThreads.back(), mCpu))
+			fprintf(stderr, "Could not pin FLAC encoder %d to "
+				"core %d.\n", i, mCpu);
+		if(mPriority > 0 &&
+		   !realtime_thread(mThreads.back(), mPriority))
+			fprintf(stderr, "Could not raise the priority of "
+				"FLAC encoder %d.\n", i);
+	}
+}
+
+void FlacFile::schedule(int cpu, int priority)
+{
+	mCpu = cpu;
+	mPriority = priority;
+	/* Start the encoders and allocate the blocks before the capture */
+	begin();
+}
+
+FlacFile::Block * FlacFile::take()
+{
+	Block * block = mFree.back();
+	mFree.pop_back();
+	block->number = mBlocks;
+	block->frames = 0;
+	block->encoded = false;
+	block->data.clear();
+	return block;
+}
+
+size_t FlacFile::write(const void * buffer, int nFrames)
+{
+	begin();
+	int bytes = mBitsPerSample / 8;
+	const unsigned char * p = (const unsigned char *) buffer;
+	md5_update(mMd5.state, mMd5.buffer, &mMd5.length, p,
+		   (size_t) nFrames * bytes * mNumChannels);
+
+	for (int f = 0; f < nFrames; f++) {
+		int * s = &mBlock->samples[mBlock->frames];
+		for (int c = 0; c < mNumChannels; c++) {
+			/* Little endian, sign extended from the top byte */
+			int value = 0;
+			for (int b = 0; b < bytes; b++)
+				value |= (unsigned) *p++ <<
+					(8 * b + 32 - 8 * bytes);
+			value >>= 32 - 8 * bytes;
+			s[c * BLOCK_SIZE] = value;
+			float a = fabs((float) value);
+			if(a > mLevels[c])
+				mLevels[c] = a;
+		}
+		mFrames++;
+		if(++mBlock->frames == BLOCK_SIZE)
+			submit();
+	}
+	return nFrames;
+}
+
+void FlacFile::submit()
+{
+	unique_lock<mutex> lock(mMutex);
+	/* Bound the memory held by blocks waiting for the encoders */
+	while(mBlocks - mNextWrite >= mSlots.size())
+		mDone.wait(lock);
+	mSlots[mBlocks % mSlots.size()] = mBlock;
+	mBlocks++;
+	/* One more than the slots, so there is always a free one here */
+	mBlock = take();
+	mWork.notify_one();
+}
+
+void FlacFile::work()
+{
+	for(;;) {
+		Block * block;
+		{
+			unique_lock<mutex> lock(mMutex);
+			while(mRunning && mNextEncode == mBlocks)
+				mWork.wait(lock);
+			if(mNextEncode == mBlocks)
+				return;
+			block = mSlots[mNextEncode % mSlots.size()];
+			mNextEncode++;
+		}
+		encode_frame(block->data, block->number, &block->samples[0],
+			     block->frames, mNumChannels, mBitsPerSample);
+		store(block);
+	}
+}
+
+void FlacFile::store(Block * block)
+{
+	lock_guard<mutex> lock(mMutex);
+	block->encoded = true;
+	/* Whoever finishes the next block in order writes it out */
+	while(mNextWrite != mBlocks &&
+	      mSlots[mNextWrite % mSlots.size()]->encoded) {
+		Block * b = mSlots[mNextWrite % mSlots.size()];
+		size_t size = b->data.size();
+		if(fwrite(&b->data[0], 1, size, mFid) != size) {
+			fprintf(stderr, "Error writing FLAC frame.\n");
+			exit(1);
+		}
+		if(!mMinFrameSize || size < mMinFrameSize)
+			mMinFrameSize = size;
+		if(size > mMaxFrameSize)
+			mMaxFrameSize = size;
+		mSlots[mNextWrite % mSlots.size()] = NULL;
+		mFree.push_back(b);
+		mNextWrite++;
+	}
+	mDone.notify_all();
+}
+
+static void put_be(vector<unsigned char> & out, unsigned long long value,
+		   int bytes)
+{
+	for (int i = bytes - 1; i >= 0; i--)
+		out.push_back((value >> (8 * i)) & 0xff);
+}
+
+static void put_le32(vector<unsigned char> & out, unsigned value)
+{
+	for (int i = 0; i < 4; i++)
+		out.push_back((value >> (8 * i)) & 0xff);
+}
+
+void FlacFile::write_metadata(bool final)
+{
+	vector<unsigned char> m;
+	m.push_back('f');
+	m.push_back('L');
+	m.push_back('a');
+	m.push_back('C');
+
+	/* STREAMINFO */
+	put_be(m, 34, 4);
+	int block = mBlocks > 1 || mFrames == 0 ? BLOCK_SIZE : (int) mFrames;
+	put_be(m, block, 2);
+	put_be(m, block, 2);
+	put_be(m, mMinFrameSize, 3);
+	put_be(m, mMaxFrameSize, 3);
+	put_be(m, ((unsigned long long) mSampleRate << 44) |
+	       ((unsigned long long) (mNumChannels - 1) << 41) |
+	       ((unsigned long long) (mBitsPerSample - 1) << 36) |
+	       (mFrames & 0xfffffffffULL), 8);
+	unsigned char digest[16] = { 0 };
+	if(final) {
+		Md5 md5 = mMd5;
+		md5_final(md5.state, md5.buffer, md5.length, digest);
+	}
+	m.insert(m.end(), digest, digest + 16);
+
+	/* VORBIS_COMMENT with the gaps, as many as fit */
+	vector<unsigned char> c;
+	put_le32(c, strlen(FLAC_VENDOR));
+	c.insert(c.end(), FLAC_VENDOR, FLAC_VENDOR + strlen(FLAC_VENDOR));
+	vector<string> comments;
+	size_t room = FLAC_METADATA_SIZE - 8 - c.size() - 4;
+	for (size_t i = 0; i < mGaps.size(); i += 2) {
+		ostringstream s;
+		s << "I2S_GAP=" << mGaps[i] << "," << mGaps[i+1];
+		if(4 + s.str().size() > room) {
+			fprintf(stderr, "Warning: only %u of %u gaps fit in "
+				"the FLAC header.\n",
+				(unsigned) comments.size(),
+				(unsigned) mGaps.size() / 2);
+			break;
+		}
+		room -= 4 + s.str().size();
+		comments.push_back(s.str());
+	}
+	put_le32(c, comments.size());
+	for (size_t i = 0; i < comments.size(); i++) {
+		put_le32(c, comments[i].size());
+		c.insert(c.end(), comments[i].begin(), comments[i].end());
+	}
+	put_be(m, (4ULL << 24) | c.size(), 4);
+	m.insert(m.end(), c.begin(), c.end());
+
+	/* PADDING for the rest */
+	size_t padding = FLAC_METADATA_SIZE - 4 - c.size() - 4;
+	put_be(m, (0x81ULL << 24) | padding, 4);
+	m.resize(m.size() + padding, 0);
+
+	if(fseek(mFid, 0, SEEK_SET)){
+		fprintf(stderr, "fseek() failed.\n");
+		exit(1);
+	}
+	if(fwrite(&m[0], 1, m.size(), mFid) != m.size()) {
+		fprintf(stderr, "Error writing FLAC header.\n");
+		exit(1);
+	}
+	fseek(mFid, 0, SEEK_END);
+}
+
+int FlacFile::sampleRate() const
+{
+	return mSampleRate;
+}
+
+void FlacFile::sampleRate(int rate)
+{
+	mSampleRate = rate;
+}
+
+int FlacFile::channelCount() const
+{
+	return mNumChannels;
+}
+
+void FlacFile::channelCount(int count)
+{
+	mNumChannels = count;
+}
+
+int FlacFile::bitsPerSample() const
+{
+	return mBitsPerSample;
+}
+
+void FlacFile::bitsPerSample(int nbits)
+{
+	mBitsPerSample = nbits;
+}
+
+void FlacFile::level_db(double * db)
+{
+	if(!mLevels) {
+		for (int i = 0; i < mNumChannels; i++)
+			db[i] = -INFINITY;
+		return;
+	}
+	long unsigned v = (0x1U << (mBitsPerSample-1));
+	for (int i = 0; i < mNumChannels; i++) {
+		db[i] = 20*log10(mLevels[i] / v);
+		mLevels[i] = 0;
+	}
+}
+
+void FlacFile::addGap(unsigned frame, unsigned length)
+{
+	lock_guard<mutex> lock(mMutex);
+	mGaps.push_back(frame);
+	mGaps.push_back(length);
+}
@@ -0,0 +1,99 @@
+#ifndef FLACFILE_HPP_
+#define FLACFILE_HPP_
+
+#include <string>
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "audiofile.hpp"
+
+using namespace std;
+
+/*
+ * Lossless FLAC writer. Frames are gathered into fixed size blocks that
+ * a small pool of threads encodes (fixed predictors, Rice coded
+ * residuals), the blocks are written in order as they complete.
+ * The blocks come from a pool allocated when the encoders start, so
+ * writing frames does not allocate.
+ * Gaps are stored as I2S_GAP=frame,length Vorbis comments.
+ */
+class FlacFile : public AudioFile
+{
+public:
+	FlacFile(const string & fileName, int threads = 2);
+	~FlacFile();
+
+	size_t write(const void * buffer, int Nframes);
+
+	int sampleRate() const;
+	void sampleRate(int rate);
+	int channelCount() const;
+	void channelCount(int count);
+	int bitsPerSample() const;
+	void bitsPerSample(int nbits);
+
+	void level_db(double * db);
+	void addGap(unsigned frame, unsigned length);
+	void schedule(int cpu, int priority);
+
+	static const int BLOCK_SIZE = 4096;
+	static const int MAX_CHANNELS = 8;
+	/* Whether a stream of this format can be encoded at all */
+	static bool supports(int channels, int bits);
+
+private:
+	struct Block {
+		unsigned long number;
+		int frames;
+		vector<int> samples;	/* BLOCK_SIZE samples per channel */
+		vector<unsigned char> data;
+		bool encoded;
+	};
+
+	struct Md5 {
+		unsigned int state[4];
+		unsigned long long length;
+		unsigned char buffer[64];
+	};
+
+	void begin();
+	/* A free block numbered mBlocks, with mMutex held or no encoders */
+	Block * take();
+	void submit();
+	void work();
+	void store(Block * block);
+	void write_metadata(bool final);
+
+	FILE * mFid;
+	const string mFileName;
+	int mSampleRate;
+	int mNumChannels;
+	int mBitsPerSample;
+	int mThreadCount;
+	int mCpu;
+	int mPriority;
+	bool mStarted;
+
+	Block * mBlock;
+	unsigned long mBlocks;
+	unsigned long long mFrames;
+	unsigned mMinFrameSize;
+	unsigned mMaxFrameSize;
+	Md5 mMd5;
+	float * mLevels;
+	vector<unsigned> mGaps;
+
+	vector<thread> mThreads;
+	mutex mMutex;
+	condition_variable mWork;
+	condition_variable mDone;
+	/* Blocks mNextWrite to mBlocks - 1 by number modulo the size */
+	vector<Block *> mSlots;
+	vector<Block *> mFree;
+	unsigned long mNextEncode;
+	unsigned long mNextWrite;
+	bool mRunning;
+};
+#endif /* FLACFILE_HPP_ */
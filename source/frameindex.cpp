@@ -0,0 +1,180 @@
+#include <cstdlib>
+#include <cstring>
+#include "frameindex.hpp"
+
+#define INDEX_MAGIC "I2SX"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 32
+#define INDEX_ENTRY_SIZE 24
+
+static void put4(unsigned char * p, unsigned value)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (value >> (8 * i)) & 0xff;
+}
+
+static void put8(unsigned char * p, unsigned long long value)
+{
+	for (int i = 0; i < 8; i++)
+		p[i] = (value >> (8 * i)) & 0xff;
+}
+
+static unsigned get4(const unsigned char * p)
+{
+	unsigned value = 0;
+	for (int i = 0; i < 4; i++)
+		value |= (unsigned) p[i] << (8 * i);
+	return value;
+}
+
+static unsigned long long get8(const unsigned char * p)
+{
+	unsigned long long value = 0;
+	for (int i = 0; i < 8; i++)
+		value |= (unsigned long long) p[i] << (8 * i);
+	return value;
+}
+
+FrameIndex::FrameIndex()
+	:fid_(NULL), rate_(0), bits_(0), channels_(0), wires_(0),
+	 interval_(DEFAULT_INTERVAL)
+{
+}
+
+FrameIndex::~FrameIndex()
+{
+	close();
+}
+
+void FrameIndex::create(const string & fileName, unsigned rate, int bits,
+			int channels, int wires, unsigned interval)
+{
+	close();
+	fid_ = fopen(fileName.c_str(), "wb");
+	if(!fid_){
+		fprintf(stderr, "Error opening filename: %s.\n",
+			fileName.c_str());
+		exit(1);
+	}
+	rate_ = rate;
+	bits_ = bits;
+	channels_ = channels;
+	wires_ = wires;
+	interval_ = interval;
+	entries_.clear();
+
+	unsigned char header[INDEX_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	memcpy(header, INDEX_MAGIC, 4);
+	put4(header + 4, INDEX_VERSION);
+	put4(header + 8, rate_);
+	put4(header + 12, bits_);
+	put4(header + 16, channels_);
+	put4(header + 20, wires_);
+	put4(header + 24, interval_);
+	fwrite(header, sizeof(header), 1, fid_);
+}
+
+bool FrameIndex::load(const string & fileName)
+{
+	close();
+	entries_.clear();
+	FILE * fid = fopen(fileName.c_str(), "rb");
+	if(!fid)
+		return false;
+
+	unsigned char header[INDEX_HEADER_SIZE];
+	if(fread(header, sizeof(header), 1, fid) != 1 ||
+	   memcmp(header, INDEX_MAGIC, 4) ||
+	   get4(header + 4) != INDEX_VERSION) {
+		fprintf(stderr, "Error: %s is not a frame index.\n",
+			fileName.c_str());
+		fclose(fid);
+		return false;
+	}
+	rate_ = get4(header + 8);
+	bits_ = get4(header + 12);
+	channels_ = get4(header + 16);
+	wires_ = get4(header + 20);
+	interval_ = get4(header + 24);
+
+	/* A capture that was cut short may leave a partial last entry */
+	unsigned char data[INDEX_ENTRY_SIZE];
+	while(fread(data, sizeof(data), 1, fid) == 1) {
+		FrameIndexEntry e;
+		e.frame = get8(data);
+		e.offset = get8(data + 8);
+		e.time_s = get8(data + 16) * 1e-9;
+		entries_.push_back(e);
+	}
+	fclose(fid);
+	return true;
+}
+
+void FrameIndex::close()
+{
+	if(fid_)
+		fclose(fid_);
+	fid_ = NULL;
+}
+
+void FrameIndex::add(const FrameIndexEntry & entry)
+{
+	entries_.push_back(entry);
+	if(!fid_)
+		return;
+	unsigned char data[INDEX_ENTRY_SIZE];
+	put8(data, entry.frame);
+	put8(data + 8, entry.offset);
+	put8(data + 16, (unsigned long long) (entry.time_s * 1e9 + 0.5));
+	fwrite(data, sizeof(data), 1, fid_);
+}
+
+const FrameIndexEntry * FrameIndex::find(double time_s) const
+{
+	/* Entries are in capture order, so times only grow */
+	size_t lo = 0, hi = entries_.size();
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if(entries_[mid].time_s <= time_s)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? &entries_[lo - 1] : NULL;
+}
+
+size_t FrameIndex::size() const
+{
+	return entries_.size();
+}
+
+const FrameIndexEntry & FrameIndex::entry(size_t i) const
+{
+	return entries_[i];
+}
+
+unsigned FrameIndex::rate() const
+{
+	return rate_;
+}
+
+int FrameIndex::bits() const
+{
+	return bits_;
+}
+
+int FrameIndex::channels() const
+{
+	return channels_;
+}
+
+int FrameIndex::wires() const
+{
+	return wires_;
+}
+
+unsigned FrameIndex::interval() const
+{
+	return interval_;
+}
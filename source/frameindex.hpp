@@ -0,0 +1,65 @@
+#ifndef FRAMEINDEX_HPP_
+#define FRAMEINDEX_HPP_
+
+#include <string>
+#include <cstdio>
+#include <vector>
+
+using namespace std;
+
+struct FrameIndexEntry {
+	/* Frames decoded before this point, the frame number in the audio file */
+	unsigned long long frame;
+	/* Byte offset of the point in the raw logic data */
+	unsigned long long offset;
+	/* Capture time of the point including gaps, in seconds */
+	double time_s;
+};
+
+/*
+ * Sparse sidecar index of a raw logic stream, an entry every interval
+ * frames. Entries sit right after a frame sync, where the decoder has
+ * no state left but the format: decoding can start at any entry with
+ * I2sDecoder::seek() and gives exactly the frames a decode from the
+ * beginning would. The file holds a header with the format followed
+ * by fixed size little endian entries, appended as the capture goes.
+ */
+class FrameIndex
+{
+public:
+	static const unsigned DEFAULT_INTERVAL = 4800;
+
+	FrameIndex();
+	~FrameIndex();
+
+	/* Start a new index file, entries are added with add(). */
+	void create(const string & fileName, unsigned rate, int bits,
+		    int channels, int wires,
+		    unsigned interval = DEFAULT_INTERVAL);
+	/* Read a whole index, false if it does not exist or is invalid. */
+	bool load(const string & fileName);
+	void close();
+
+	void add(const FrameIndexEntry & entry);
+
+	/* Last entry at or before the time, NULL before the first one. */
+	const FrameIndexEntry * find(double time_s) const;
+	size_t size() const;
+	const FrameIndexEntry & entry(size_t i) const;
+
+	unsigned rate() const;
+	int bits() const;
+	int channels() const;
+	int wires() const;
+	unsigned interval() const;
+
+private:
+	FILE * fid_;
+	unsigned rate_;
+	int bits_;
+	int channels_;
+	int wires_;
+	unsigned interval_;
+	vector<FrameIndexEntry> entries_;
+};
+#endif
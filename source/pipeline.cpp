@@ -0,0 +1,431 @@
+#include <cstdlib>
+#include <iostream>
+#include "affinity.hpp"
+#include "pipeline.hpp"
+
+/* Ring slots allocated up front, about a second of SDK buffers */
+#define PIPELINE_QUEUE_BUFFERS 256
+
+Pipeline::Pipeline(int index, CaptureSource * source, int bits,
+		   int channels, int wires)
+	:index_(index), source_(source), decoder_(bits, channels, wires),
+	 audio_(NULL), pcm_(NULL), raw_(NULL), raw_direct_(NULL),
+	 analyzer_(NULL), timing_(NULL),
+	 frame_index_(NULL), index_base_(0),
+	 queue_(PIPELINE_QUEUE_BUFFERS), queue_head_(0), queue_count_(0),
+	 running_(false), max_queue_s_(1.0), queued_bytes_(0),
+	 dropping_(false), dropped_bytes_(0), writer_cpu_(-1), callback_cpu_(-1), priority_(0), frames_(0),
+	 started_(false), last_end_s_(0), gap_pending_(false), gap_frame_(0),
+	 gap_dropped_(0), gap_from_(0), gap_lost_s_(0), gap_open_(false),
+	 frame_period_(0), last_frame_position_(0), skipped_(0)
+{
+	PipelineStats empty = { 0, 0, 0, 0, 0.0, 0, 0, 0.0, false,
+				{ 0, 0, 0, 0 } };
+	stats_ = empty;
+	decoder_.registerOnFrame(&OnFrame, this);
+	source_->registerOnData(&OnData, this);
+	source_->registerOnError(&OnError, this);
+}
+
+Pipeline::~Pipeline()
+{
+	stop();
+	delete source_;
+	delete audio_;
+	delete analyzer_;
+	delete timing_;
+	delete frame_index_;
+	if(pcm_)
+		fclose(pcm_);
+	if(raw_)
+		fclose(raw_);
+	delete raw_direct_;
+}
+
+void Pipeline::output(AudioFile * audio)
+{
+	audio_ = audio;
+}
+
+void Pipeline::output(FILE * pcm)
+{
+	pcm_ = pcm;
+}
+
+void Pipeline::dump(FILE * raw)
+{
+	raw_ = raw;
+}
+
+void Pipeline::dump(DirectWriter * raw)
+{
+	raw_direct_ = raw;
+}
+
+void Pipeline::analyze(SpectrumAnalyzer * analyzer)
+{
+	analyzer_ = analyzer;
+}
+
+void Pipeline::maxQueue(double seconds)
+{
+	max_queue_s_ = seconds;
+}
+
+void Pipeline::timing(TimingAnalyzer * timing)
+{
+	timing_ = timing;
+	decoder_.registerOnTiming(timing_ ? &OnTiming : NULL, this);
+}
+
+void Pipeline::index(FrameIndex * index)
+{
+	frame_index_ = index;
+}
+
+void Pipeline::seek(const FrameIndexEntry & entry)
+{
+	decoder_.seek(entry.offset);
+	index_base_ = entry.offset;
+}
+
+Pipeline::clock::time_point Pipeline::epoch()
+{
+	static const clock::time_point t0 = clock::now();
+	return t0;
+}
+
+void Pipeline::schedule(int writer_cpu, int callback_cpu, int priority)
+{
+	writer_cpu_ = writer_cpu;
+	callback_cpu_ = callback_cpu;
+	priority_ = priority;
+}
+
+void Pipeline::start(int cpu)
+{
+	epoch();
+	running_ = true;
+	if(analyzer_)
+		analyzer_->start();
+	worker_ = std::thread(&Pipeline::work, this);
+	if(cpu >= 0 && !pin_thread(worker_, cpu))
+		std::cerr << "Could not pin device " << index_ <<
+			" to core " << cpu << "." << std::endl;
+	if(priority_ > 0 && !realtime_thread(worker_, priority_))
+		std::cerr << "Could not raise the priority of device " <<
+			index_ << "." << std::endl;
+	int writer_priority = priority_ > 1 ? priority_ - 1 : priority_;
+	if(audio_)
+		audio_->schedule(writer_cpu_, writer_priority);
+	if(raw_direct_)
+		raw_direct_->schedule(writer_cpu_, writer_priority);
+	source_->start();
+}
+
+void Pipeline::stop()
+{
+	source_->stop();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		running_ = false;
+	}
+	ready_.notify_one();
+	space_.notify_all();
+	if(worker_.joinable())
+		worker_.join();
+	if(analyzer_)
+		analyzer_->stop();
+}
+
+void Pipeline::restart()
+{
+	source_->stop();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		Buffer marker = { NULL, (unsigned) dropped_bytes_, 0.0 };
+		enqueue(marker);
+		dropping_ = false;
+		dropped_bytes_ = 0;
+	}
+	ready_.notify_one();
+	source_->clearError();
+	source_->start();
+}
+
+int Pipeline::index() const
+{
+	return index_;
+}
+
+SpectrumAnalyzer * Pipeline::analyzer() const
+{
+	return analyzer_;
+}
+
+TimingAnalyzer * Pipeline::timing() const
+{
+	return timing_;
+}
+
+DirectWriter * Pipeline::directDump() const
+{
+	return raw_direct_;
+}
+
+CaptureSource * Pipeline::source() const
+{
+	return source_;
+}
+
+AudioFile * Pipeline::audio() const
+{
+	return audio_;
+}
+
+unsigned long Pipeline::frames() const
+{
+	return frames_;
+}
+
+PipelineStats Pipeline::stats()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	stats_.frames = frames_;
+	return stats_;
+}
+
+void Pipeline::OnData(CaptureSource * source, unsigned char * data,
+		      unsigned length, void * user_data)
+{
+	Pipeline * p = (Pipeline *) user_data;
+	double now = std::chrono::duration<double>(
+		clock::now() - epoch()).count();
+	Buffer buffer = { data, length, now };
+	bool drop = false;
+	bool overrun = false;
+	{
+		std::unique_lock<std::mutex> lock(p->mutex_);
+		if(!p->started_) {
+			/* The first call tells which thread the source uses */
+			if(p->callback_cpu_ >= 0 &&
+			   !pin_current_thread(p->callback_cpu_))
+				std::cerr << "Could not pin the callbacks of "
+					"device " << p->index_ << " to core " <<
+					p->callback_cpu_ << "." << std::endl;
+			if(p->priority_ > 0 &&
+			   !realtime_current_thread(p->priority_ + 1))
+				std::cerr << "Could not raise the priority of "
+					"the callbacks of device " <<
+					p->index_ << "." << std::endl;
+			/* The buffer ends now, so it started length samples ago */
+			p->stats_.start_s = now -
+				(double) length / source->sampleRate();
+			p->started_ = true;
+		}
+		p->stats_.bytes += length;
+		p->stats_.buffers++;
+
+		unsigned long long limit = (unsigned long long)
+			(p->max_queue_s_ * source->sampleRate());
+		if(!source->live())
+			while(p->running_ && p->queued_bytes_ &&
+			      p->queued_bytes_ + length > limit)
+				p->space_.wait(lock);
+		if(p->dropping_ ||
+		   (p->queued_bytes_ && p->queued_bytes_ + length > limit)) {
+			overrun = !p->dropping_;
+			drop = true;
+			p->dropping_ = true;
+			p->dropped_bytes_ += length;
+			p->stats_.dropped += length;
+		} else {
+			p->enqueue(buffer);
+			p->queued_bytes_ += length;
+			if(p->queue_count_ > p->stats_.max_queued)
+				p->stats_.max_queued = p->queue_count_;
+		}
+	}
+	if(drop) {
+		source->release(data);
+		if(overrun)
+			source->overrun();
+		return;
+	}
+	p->ready_.notify_one();
+}
+
+void Pipeline::OnError(CaptureSource * source, void * user_data)
+{
+	Pipeline * p = (Pipeline *) user_data;
+	std::cerr << "Device " << p->index_ << " reported an Error. This probably means that it could not keep up at the given data rate, or was disconnected. Restarting, the gap is marked in the audio file." << std::endl;
+	{
+		std::lock_guard<std::mutex> lock(p->mutex_);
+		p->stats_.errors++;
+	}
+	/*
+	 * note that you should not attempt to restart data collection
+	 *  from this function --
+	 * the main thread does it with restart() once it gets the event.
+	 */
+}
+
+void Pipeline::OnFrame(const char * frame, void * user_data)
+{
+	Pipeline * p = (Pipeline *) user_data;
+	unsigned long long position = p->decoder_.framePosition();
+	if(p->gap_open_)
+		p->close_gap();
+	else if(p->frames_)
+		p->frame_period_ = position - p->last_frame_position_;
+	p->last_frame_position_ = position;
+
+	if(p->audio_) {
+		if(p->audio_->write(frame, 1) != 1){
+			fprintf(stderr, "Error in writing audio file.\n");
+			exit(1);
+		}
+	}
+	if(p->pcm_)
+		fwrite(frame, p->decoder_.frameSize(), 1, p->pcm_);
+	if(p->analyzer_)
+		p->analyzer_->push(frame);
+	p->frames_++;
+
+	if(p->frame_index_ &&
+	   p->frames_ % p->frame_index_->interval() == 0) {
+		FrameIndexEntry entry;
+		entry.frame = p->frames_;
+		entry.offset = p->decoder_.framePosition() - p->index_base_;
+		/* Only the worker changes lost_s */
+		entry.time_s = (double) entry.offset /
+			p->source_->sampleRate() + p->stats_.lost_s;
+		p->frame_index_->add(entry);
+	}
+}
+
+void Pipeline::OnTiming(const FrameTiming * timing, void * user_data)
+{
+	Pipeline * p = (Pipeline *) user_data;
+	p->timing_->add(*timing);
+}
+
+void Pipeline::gap(const Buffer & after)
+{
+	double lost;
+	long long skipped = source_->skipped();
+	if(skipped >= 0) {
+		/* The source knows what it skipped, add what we dropped */
+		lost = (double) (skipped - skipped_ + gap_dropped_) /
+			source_->sampleRate();
+		skipped_ = skipped;
+	} else {
+		/* From the last sample before the error to the first after */
+		lost = after.end_s - (double) after.length /
+			source_->sampleRate() - last_end_s_;
+		if(lost < 0)
+			lost = 0;
+	}
+	gap_pending_ = false;
+	gap_dropped_ = 0;
+	gap_lost_s_ += lost;
+	gap_open_ = true;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stats_.lost_s += lost;
+	}
+}
+
+void Pipeline::close_gap()
+{
+	/*
+	 * The frame just completed starts a period before the decoder
+	 * position, what lies between was decoded without a frame sync.
+	 */
+	unsigned rate = source_->sampleRate();
+	unsigned long long start = decoder_.framePosition() - frame_period_;
+	double lost = gap_lost_s_;
+	if(frame_period_ && start > gap_from_)
+		lost += (double) (start - gap_from_) / rate;
+	gap_open_ = false;
+	gap_lost_s_ = 0;
+
+	if(audio_) {
+		/* Something was lost even if it is shorter than a sample */
+		unsigned length = (unsigned) (lost * audio_->sampleRate() + 0.5);
+		audio_->addGap(gap_frame_, length ? length : 1);
+	}
+	std::cerr << "Device " << index_ << ": gap of " << lost * 1e3 <<
+		" ms after " << gap_frame_ << " samples." << std::endl;
+}
+
+void Pipeline::enqueue(const Buffer & buffer)
+{
+	if(queue_count_ == queue_.size()) {
+		/* Unwrap into a ring twice the size */
+		std::vector<Buffer> bigger(queue_.size() * 2);
+		for (size_t i = 0; i < queue_count_; i++)
+			bigger[i] = queue_[(queue_head_ + i) % queue_.size()];
+		queue_.swap(bigger);
+		queue_head_ = 0;
+	}
+	queue_[(queue_head_ + queue_count_) % queue_.size()] = buffer;
+	queue_count_++;
+}
+
+Pipeline::Buffer Pipeline::dequeue()
+{
+	Buffer buffer = queue_[queue_head_];
+	queue_head_ = (queue_head_ + 1) % queue_.size();
+	queue_count_--;
+	return buffer;
+}
+
+void Pipeline::work()
+{
+	for(;;) {
+		Buffer buffer;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			while(running_ && !queue_count_)
+				ready_.wait(lock);
+			/* Drain what was captured before stopping */
+			if(!queue_count_)
+				break;
+			buffer = dequeue();
+			if(buffer.data)
+				queued_bytes_ -= buffer.length;
+		}
+		space_.notify_one();
+
+		if(buffer.data == NULL) {
+			/* A second restart before any frame extends the gap */
+			if(!gap_pending_ && !gap_open_)
+				gap_from_ = decoder_.framePosition();
+			decoder_.reset();
+			if(analyzer_)
+				analyzer_->reset();
+			gap_pending_ = true;
+			gap_frame_ = frames_;
+			gap_dropped_ += buffer.length;
+			continue;
+		}
+		if(gap_pending_)
+			gap(buffer);
+		last_end_s_ = buffer.end_s;
+
+		if(raw_)
+			fwrite(buffer.data, sizeof(unsigned char),
+			       buffer.length, raw_);
+		if(raw_direct_)
+			raw_direct_->write(buffer.data, buffer.length);
+		decoder_.decode(buffer.data, buffer.length);
+		source_->release(buffer.data);
+	}
+
+	ThreadCounters counters;
+	bool counted = thread_counters(&counters);
+	std::lock_guard<std::mutex> lock(mutex_);
+	stats_.counted = counted;
+	stats_.worker = counters;
+}
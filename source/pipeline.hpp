@@ -0,0 +1,177 @@
+#ifndef PIPELINE_HPP_
+#define PIPELINE_HPP_
+
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include "capturesource.hpp"
+#include "decoder.hpp"
+#include "audiofile.hpp"
+#include "analyzer.hpp"
+#include "frameindex.hpp"
+#include "directwriter.hpp"
+#include "timing.hpp"
+#include "affinity.hpp"
+
+struct PipelineStats {
+	unsigned long long bytes;
+	unsigned long buffers;
+	unsigned long frames;
+	unsigned long max_queued;
+	/* Estimated first logic sample, seconds after Pipeline::epoch() */
+	double start_s;
+	unsigned long errors;
+	/* Logic data dropped because the worker fell behind */
+	unsigned long long dropped;
+	/* Estimated capture time lost to errors */
+	double lost_s;
+	/* Page faults and context switches of the worker, when supported */
+	bool counted;
+	ThreadCounters worker;
+};
+
+/*
+ * One capture source with its own decoder, output files and worker
+ * thread. The source callback only queues buffers; decoding and
+ * writing happen on the worker.
+ */
+class Pipeline
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	Pipeline(int index, CaptureSource * source, int bits, int channels,
+		 int wires);
+	~Pipeline();
+
+	/* Outputs are owned and closed by the pipeline. */
+	void output(AudioFile * audio);
+	void output(FILE * pcm);
+	void dump(FILE * raw);
+	void dump(DirectWriter * raw);
+	void analyze(SpectrumAnalyzer * analyzer);
+	/*
+	 * Logic data that may wait for the worker, in seconds. Beyond
+	 * that a live source gets an overrun, other sources wait.
+	 */
+	void maxQueue(double seconds);
+	void timing(TimingAnalyzer * timing);
+	/* Add an entry to the index every interval frames. */
+	void index(FrameIndex * index);
+	/*
+	 * Decode from a frame index entry, before start(). Index entries
+	 * are then counted from there, as the dump and audio files start
+	 * there.
+	 */
+	void seek(const FrameIndexEntry & entry);
+
+	/*
+	 * Real-time priority (0 = normal) for the worker; the source
+	 * callback, on callback_cpu, gets one more and the file writers,
+	 * on writer_cpu, one less. -1 leaves a thread on any core.
+	 */
+	void schedule(int writer_cpu, int callback_cpu, int priority);
+	/* Start the worker on the given core (-1 = any) and the source. */
+	void start(int cpu);
+	void stop();
+	/*
+	 * Restart the source after an error, from the main thread. The
+	 * gap is recorded in the audio file and decoding resyncs.
+	 */
+	void restart();
+
+	int index() const;
+	CaptureSource * source() const;
+	AudioFile * audio() const;
+	SpectrumAnalyzer * analyzer() const;
+	TimingAnalyzer * timing() const;
+	DirectWriter * directDump() const;
+	unsigned long frames() const;
+	PipelineStats stats();
+
+	/* Common time reference for start timestamps of all pipelines. */
+	static clock::time_point epoch();
+
+private:
+	/*
+	 * A NULL buffer marks a restart after an error, its length is
+	 * the data dropped before.
+	 */
+	struct Buffer {
+		unsigned char * data;
+		unsigned length;
+		double end_s;
+	};
+
+	static void OnData(CaptureSource * source, unsigned char * data,
+			   unsigned length, void * user_data);
+	static void OnError(CaptureSource * source, void * user_data);
+	static void OnFrame(const char * frame, void * user_data);
+	static void OnTiming(const FrameTiming * timing, void * user_data);
+
+	void work();
+	/* The ring, with mutex_ held */
+	void enqueue(const Buffer & buffer);
+	Buffer dequeue();
+	/* Time the source lost, at the first buffer after a restart */
+	void gap(const Buffer & after);
+	/* Mark the gap once the decoder found the next frame */
+	void close_gap();
+
+	int index_;
+	CaptureSource * source_;
+	I2sDecoder decoder_;
+	AudioFile * audio_;
+	FILE * pcm_;
+	FILE * raw_;
+	DirectWriter * raw_direct_;
+	SpectrumAnalyzer * analyzer_;
+	TimingAnalyzer * timing_;
+	FrameIndex * frame_index_;
+	unsigned long long index_base_;
+
+	std::thread worker_;
+	std::mutex mutex_;
+	std::condition_variable ready_;
+	std::condition_variable space_;
+	/* Ring of queued buffers, it only grows when a burst outgrows it */
+	std::vector<Buffer> queue_;
+	size_t queue_head_;
+	size_t queue_count_;
+	bool running_;
+	double max_queue_s_;
+	unsigned long long queued_bytes_;
+	/* Set on an overrun, data is dropped until restart() */
+	bool dropping_;
+	unsigned long long dropped_bytes_;
+
+	int writer_cpu_;
+	int callback_cpu_;
+	int priority_;
+
+	std::atomic<unsigned long> frames_;
+	PipelineStats stats_;
+	bool started_;
+
+	/* Worker side restart bookkeeping */
+	double last_end_s_;
+	bool gap_pending_;
+	unsigned long gap_frame_;
+	/* Dropped by OnData since the last gap, from the markers */
+	unsigned long long gap_dropped_;
+	/* Decoder position of the first missing frame */
+	unsigned long long gap_from_;
+	/* Source time lost in the open gap, not seen by the decoder */
+	double gap_lost_s_;
+	bool gap_open_;
+	/* Logic samples per frame, from the last two frames */
+	unsigned long long frame_period_;
+	unsigned long long last_frame_position_;
+	/* source_->skipped() when the last gap was recorded */
+	long long skipped_;
+};
+#endif
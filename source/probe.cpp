@@ -0,0 +1,119 @@
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include "probe.hpp"
+
+ClockProbe::ClockProbe(unsigned rate)
+	:rate_(rate), position_(0), captured_(0)
+{
+	memset(&fs_, 0, sizeof(fs_));
+	memset(&bclk_, 0, sizeof(bclk_));
+}
+
+void ClockProbe::edge(Edges & e, bool level)
+{
+	if(!e.seen) {
+		e.seen = true;
+		e.level = level;
+		return;
+	}
+	if(level == e.level)
+		return;
+	e.edges++;
+
+	/* Only pulses between two seen edges have a known length */
+	if(e.rises || e.lows || e.highs) {
+		unsigned long long length = position_ - e.last_edge;
+		if(!e.shortest || length < e.shortest)
+			e.shortest = length;
+		if(length > e.longest)
+			e.longest = length;
+		if(level) {
+			e.low += length;
+			e.lows++;
+		} else {
+			e.high += length;
+			e.highs++;
+		}
+	}
+	if(level) {
+		if(!e.rises)
+			e.first_rise = position_;
+		e.last_rise = position_;
+		e.rises++;
+	}
+	e.last_edge = position_;
+	e.level = level;
+}
+
+void ClockProbe::feed(const unsigned char * data, unsigned length)
+{
+	for (unsigned i = 0; i < length; i++) {
+		edge(fs_, (data[i] & 0x01) != 0);
+		edge(bclk_, (data[i] & 0x02) != 0);
+		position_++;
+	}
+	captured_ = position_;
+}
+
+void ClockProbe::OnData(CaptureSource * source, unsigned char * data,
+			unsigned length, void * user_data)
+{
+	ClockProbe * probe = (ClockProbe *) user_data;
+	probe->feed(data, length);
+	source->release(data);
+}
+
+void ClockProbe::capture(CaptureSource * source, double seconds)
+{
+	unsigned long long wanted = (unsigned long long) (seconds * rate_);
+	source->registerOnData(&OnData, this);
+	source->start();
+	while(captured_ < wanted && !source->failed() && !source->exhausted())
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	source->stop();
+	source->registerOnData(NULL, NULL);
+}
+
+ClockStats ClockProbe::stats(const Edges & e) const
+{
+	ClockStats s = { e.edges, 0, 0, 0, 0, 0 };
+	if(e.rises < 2 || !e.highs || !e.lows)
+		return s;
+	double period = (double) (e.last_rise - e.first_rise) /
+		(e.rises - 1);
+	double high = (double) e.high / e.highs;
+	double low = (double) e.low / e.lows;
+	s.frequency = rate_ / period;
+	s.duty = high / (high + low);
+	s.mean_half = (high < low ? high : low) / rate_;
+	s.min_half = (double) e.shortest / rate_;
+	s.max_half = (double) e.longest / rate_;
+	return s;
+}
+
+ClockStats ClockProbe::frameSync() const
+{
+	return stats(fs_);
+}
+
+ClockStats ClockProbe::bitClock() const
+{
+	return stats(bclk_);
+}
+
+unsigned ClockProbe::pick(const std::vector<unsigned> & rates,
+			  double margin) const
+{
+	ClockStats bclk = bitClock();
+	if(bclk.min_half <= 0)
+		return 0;
+	double needed = margin / bclk.min_half;
+	unsigned best = 0;
+	for (size_t i = 0; i < rates.size(); i++) {
+		if(rates[i] >= needed && (best == 0 || rates[i] < best))
+			best = rates[i];
+	}
+	return best;
+}
@@ -0,0 +1,69 @@
+#ifndef PROBE_HPP_
+#define PROBE_HPP_
+
+#include <vector>
+#include <atomic>
+#include "capturesource.hpp"
+
+/* Frequency and duty cycle of one logic input, from edge intervals. */
+struct ClockStats {
+	unsigned long edges;
+	double frequency;     /* Hz */
+	double duty;          /* High time / period */
+	double mean_half;     /* Mean of the shorter of high and low, seconds */
+	double min_half;      /* Shortest high or low pulse seen, seconds */
+	double max_half;      /* Longest high or low pulse seen, seconds */
+};
+
+/*
+ * Measures the frame sync (bit 0) and bit clock (bit 1) from a short
+ * capture and picks the lowest sample rate that still gives margin
+ * samples for the shortest half-period of the bit clock, so jitter
+ * and an uneven duty cycle are covered by what was measured.
+ */
+class ClockProbe
+{
+public:
+	ClockProbe(unsigned rate);
+
+	void feed(const unsigned char * data, unsigned length);
+	/* Capture seconds of data from the source at its current rate. */
+	void capture(CaptureSource * source, double seconds);
+
+	ClockStats frameSync() const;
+	ClockStats bitClock() const;
+
+	/* Lowest rate with margin samples in the shortest BCLK half-period */
+	unsigned pick(const std::vector<unsigned> & rates,
+		      double margin) const;
+
+private:
+	struct Edges {
+		unsigned long long first_rise;
+		unsigned long long last_rise;
+		unsigned long long last_edge;
+		unsigned long edges;
+		unsigned long rises;
+		unsigned long long high;     /* Samples in complete pulses */
+		unsigned long long low;
+		unsigned long highs;
+		unsigned long lows;
+		unsigned long long shortest;
+		unsigned long long longest;
+		bool level;
+		bool seen;
+	};
+
+	static void OnData(CaptureSource * source, unsigned char * data,
+			   unsigned length, void * user_data);
+
+	void edge(Edges & e, bool level);
+	ClockStats stats(const Edges & e) const;
+
+	unsigned rate_;
+	unsigned long long position_;
+	std::atomic<unsigned long long> captured_;
+	Edges fs_;
+	Edges bclk_;
+};
+#endif
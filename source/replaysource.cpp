@@ -0,0 +1,196 @@
+#include <cstdlib>
+#include <iostream>
+#include <chrono>
+#include "replaysource.hpp"
+
+#define REPLAY_BUFFER_SIZE (128 * 1024)
+#define REPLAY_MAX_BACKLOG_SEC 0.25
+
+/*
+ * Raw dumps easily pass 2 GB, a 32 bit build needs a 64 bit off_t for
+ * fopen() and fseeko(), see -D_FILE_OFFSET_BITS=64 in build_project.py.
+ */
+#if !defined(WIN32)
+static_assert(sizeof(off_t) >= 8, "build with -D_FILE_OFFSET_BITS=64");
+#endif
+
+static int seek_file(FILE * fid, unsigned long long offset, int whence)
+{
+#if defined(WIN32)
+	return _fseeki64(fid, (__int64) offset, whence);
+#else
+	return fseeko(fid, (off_t) offset, whence);
+#endif
+}
+
+ReplaySource::ReplaySource(const string & fileName, unsigned long long id)
+	:CaptureSource(id), file_name_(fileName), running_(false),
+	 exhausted_(false), rate_(24000000), buffer_size_(REPLAY_BUFFER_SIZE),
+	 max_backlog_(REPLAY_MAX_BACKLOG_SEC), realtime_(true), position_(0),
+	 inject_interval_(0), next_error_(0), overrun_(false), skipped_(0)
+{
+	fid_ = fopen(file_name_.c_str(), "rb");
+	if(!fid_){
+		fprintf(stderr, "Error opening filename: %s.\n",
+			file_name_.c_str());
+		exit(1);
+	}
+}
+
+ReplaySource::~ReplaySource()
+{
+	stop();
+	fclose(fid_);
+}
+
+void ReplaySource::start()
+{
+	stop();
+	if(overrun_) {
+		double lost = chrono::duration<double>(
+			clock::now() - failed_at_).count();
+		unsigned long long skip = (unsigned long long) (lost * rate_);
+		if(seek_file(fid_, skip, SEEK_CUR) == 0) {
+			position_ += skip;
+			skipped_ += skip;
+		}
+		overrun_ = false;
+	}
+	running_ = true;
+	thread_ = thread(&ReplaySource::run, this);
+}
+
+void ReplaySource::stop()
+{
+	running_ = false;
+	if(thread_.joinable())
+		thread_.join();
+}
+
+bool ReplaySource::streaming() const
+{
+	return running_;
+}
+
+bool ReplaySource::exhausted() const
+{
+	return exhausted_;
+}
+
+unsigned ReplaySource::sampleRate() const
+{
+	return rate_;
+}
+
+void ReplaySource::sampleRate(unsigned rate)
+{
+	rate_ = rate;
+}
+
+void ReplaySource::release(unsigned char * data)
+{
+	delete [] data;
+}
+
+const char * ReplaySource::name() const
+{
+	return "Replay";
+}
+
+bool ReplaySource::live() const
+{
+	return realtime_;
+}
+
+void ReplaySource::realtime(bool enable)
+{
+	realtime_ = enable;
+}
+
+void ReplaySource::bufferSize(unsigned bytes)
+{
+	buffer_size_ = bytes;
+}
+
+void ReplaySource::maxBacklog(double seconds)
+{
+	max_backlog_ = seconds;
+}
+
+void ReplaySource::injectErrors(unsigned long long interval)
+{
+	inject_interval_ = interval;
+	next_error_ = position_ + interval;
+}
+
+void ReplaySource::seek(unsigned long long offset)
+{
+	if(seek_file(fid_, offset, SEEK_SET)){
+		fprintf(stderr, "Error seeking %s to %llu.\n",
+			file_name_.c_str(), offset);
+		exit(1);
+	}
+	position_ = offset;
+	next_error_ = position_ + inject_interval_;
+	exhausted_ = false;
+	overrun_ = false;
+}
+
+void ReplaySource::overrun()
+{
+	failed_at_ = clock::now();
+	overrun_ = true;
+	running_ = false;
+	fail();
+}
+
+long long ReplaySource::skipped() const
+{
+	return skipped_;
+}
+
+void ReplaySource::run()
+{
+	clock::time_point begin = clock::now();
+	unsigned long long delivered = 0;
+
+	while(running_) {
+		unsigned char * data = new unsigned char [buffer_size_];
+		size_t n = fread(data, sizeof(unsigned char), buffer_size_,
+				 fid_);
+		if(n == 0) {
+			delete [] data;
+			exhausted_ = true;
+			break;
+		}
+
+		if(realtime_) {
+			/* A buffer is handed out once it has been "sampled". */
+			delivered += n;
+			clock::time_point due = begin +
+				chrono::duration_cast<clock::duration>(
+					chrono::duration<double>(
+						(double) delivered / rate_));
+			this_thread::sleep_until(due);
+			double late = chrono::duration<double>(
+				clock::now() - due).count();
+			if(late > max_backlog_) {
+				/* This buffer was read but is lost as well */
+				delete [] data;
+				position_ += n;
+				skipped_ += n;
+				overrun();
+				return;
+			}
+		}
+		position_ += n;
+		deliver(data, (unsigned) n);
+
+		if(inject_interval_ && position_ >= next_error_) {
+			next_error_ += inject_interval_;
+			overrun();
+			return;
+		}
+	}
+	running_ = false;
+}
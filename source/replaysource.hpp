@@ -0,0 +1,71 @@
+#ifndef REPLAYSOURCE_HPP_
+#define REPLAYSOURCE_HPP_
+
+#include <string>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "capturesource.hpp"
+
+using namespace std;
+
+/*
+ * Capture source that plays back a raw dump (as written with -d) in
+ * SDK sized buffers from its own thread. In real-time mode the buffers
+ * are paced at the sample rate and, like the device, the source gives
+ * up with an error when the consumer falls too far behind. After an
+ * error the data that would have streamed by until start() is called
+ * again is skipped, as it would be lost on the device.
+ */
+class ReplaySource : public CaptureSource
+{
+public:
+	ReplaySource(const string & fileName, unsigned long long id = 0);
+	~ReplaySource();
+
+	void start();
+	void stop();
+	bool streaming() const;
+	bool exhausted() const;
+	unsigned sampleRate() const;
+	void sampleRate(unsigned rate);
+	void release(unsigned char * data);
+	const char * name() const;
+	bool live() const;
+	/* Stop and skip what streams by until start(), like the device. */
+	void overrun();
+	long long skipped() const;
+
+	/* Pace at sample rate (default) or deliver as fast as possible. */
+	void realtime(bool enable);
+	void bufferSize(unsigned bytes);
+	/* Allowed consumer lag before reporting an error, in seconds. */
+	void maxBacklog(double seconds);
+	/* Report an error every interval bytes, 0 disables. */
+	void injectErrors(unsigned long long interval);
+	/* Continue at a byte offset of the file, before start(). */
+	void seek(unsigned long long offset);
+
+private:
+	typedef chrono::steady_clock clock;
+
+	void run();
+
+	FILE * fid_;
+	const string file_name_;
+	thread thread_;
+	atomic<bool> running_;
+	atomic<bool> exhausted_;
+	unsigned rate_;
+	unsigned buffer_size_;
+	double max_backlog_;
+	bool realtime_;
+	unsigned long long position_;
+	unsigned long long inject_interval_;
+	unsigned long long next_error_;
+	clock::time_point failed_at_;
+	bool overrun_;
+	unsigned long long skipped_;
+};
+#endif
@@ -0,0 +1,179 @@
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include "saleaesource.hpp"
+
+std::vector<SaleaeSource *> SaleaeSource::sources_;
+std::mutex SaleaeSource::sources_mutex_;
+bool SaleaeSource::accepting_ = true;
+
+void SaleaeSource::beginConnect()
+{
+	DevicesManagerInterface::RegisterOnConnect(&OnConnect);
+	DevicesManagerInterface::RegisterOnDisconnect(&OnDisconnect);
+	DevicesManagerInterface::BeginConnect();
+}
+
+std::vector<SaleaeSource *> SaleaeSource::devices()
+{
+	std::lock_guard<std::mutex> lock(sources_mutex_);
+	return sources_;
+}
+
+std::vector<SaleaeSource *> SaleaeSource::waitForDevices(size_t count,
+							 double seconds)
+{
+	typedef std::chrono::steady_clock clock;
+	clock::time_point end = clock::now() +
+		std::chrono::duration_cast<clock::duration>(
+			std::chrono::duration<double>(seconds));
+	std::vector<SaleaeSource *> sources = devices();
+	while(sources.size() < count && clock::now() < end) {
+		CaptureSource::waitEvent(std::chrono::duration<double>(
+						 end - clock::now()).count());
+		sources = devices();
+	}
+	std::lock_guard<std::mutex> lock(sources_mutex_);
+	accepting_ = false;
+	return sources_;
+}
+
+SaleaeSource::SaleaeSource(U64 id, LogicInterface * device)
+	:CaptureSource(id), device_(NULL), rate_(0)
+{
+	attach(device);
+}
+
+void SaleaeSource::attach(LogicInterface * device)
+{
+	device_ = device;
+	device_->RegisterOnReadData(&OnReadData, this);
+	device_->RegisterOnError(&OnError, this);
+	if(rate_)
+		device_->SetSampleRateHz(rate_);
+}
+
+SaleaeSource::~SaleaeSource()
+{
+	std::lock_guard<std::mutex> lock(sources_mutex_);
+	sources_.erase(std::remove(sources_.begin(), sources_.end(), this),
+		       sources_.end());
+}
+
+void SaleaeSource::start()
+{
+	if(device_)
+		device_->ReadStart();
+}
+
+void SaleaeSource::stop()
+{
+	if(device_ && device_->IsStreaming())
+		device_->Stop();
+}
+
+bool SaleaeSource::streaming() const
+{
+	return device_ && device_->IsStreaming();
+}
+
+unsigned SaleaeSource::sampleRate() const
+{
+	return rate_;
+}
+
+void SaleaeSource::sampleRate(unsigned rate)
+{
+	rate_ = rate;
+	if(device_)
+		device_->SetSampleRateHz(rate_);
+}
+
+std::vector<unsigned> SaleaeSource::supportedSampleRates()
+{
+	std::vector<unsigned> rates;
+	if(device_) {
+		U32 buffer[32];
+		S32 n = device_->GetSupportedSampleRates(buffer, 32);
+		for (S32 i = 0; i < n && i < 32; i++)
+			rates.push_back(buffer[i]);
+	}
+	return rates;
+}
+
+void SaleaeSource::release(unsigned char * data)
+{
+	DevicesManagerInterface::DeleteU8ArrayPtr(data);
+}
+
+const char * SaleaeSource::name() const
+{
+	return "Logic";
+}
+
+bool SaleaeSource::connected() const
+{
+	return device_ != NULL;
+}
+
+void __stdcall SaleaeSource::OnConnect(U64 device_id,
+				       GenericInterface * device_interface,
+				       void * user_data)
+{
+	LogicInterface * logic =
+		dynamic_cast<LogicInterface*>(device_interface);
+	if(logic == NULL)
+		return;
+
+	std::cerr << "A Logic device was connected (id=0x" <<
+		std::hex << device_id << std::dec << ")." << std::endl;
+	{
+		std::lock_guard<std::mutex> lock(sources_mutex_);
+		size_t i;
+		for (i = 0; i < sources_.size(); i++) {
+			/* Plugged back in, carry on with the same pipeline */
+			if(sources_[i]->id() == device_id) {
+				sources_[i]->attach(logic);
+				break;
+			}
+		}
+		if(i == sources_.size() && accepting_)
+			sources_.push_back(new SaleaeSource(device_id, logic));
+		else if(i == sources_.size())
+			std::cerr << "Ignoring device 0x" << std::hex <<
+				device_id << std::dec << ", the capture has "
+				"already started." << std::endl;
+	}
+	notifyEvent();
+}
+
+void __stdcall SaleaeSource::OnDisconnect(U64 device_id, void * user_data)
+{
+	{
+		std::lock_guard<std::mutex> lock(sources_mutex_);
+		for (size_t i = 0; i < sources_.size(); i++) {
+			if(sources_[i]->id() != device_id)
+				continue;
+			std::cerr << "A device was disconnected (id=0x" <<
+				std::hex << device_id << std::dec << ")." <<
+				std::endl;
+			/* The SDK owns the interface, just forget it. */
+			sources_[i]->device_ = NULL;
+		}
+	}
+	notifyEvent();
+}
+
+void __stdcall SaleaeSource::OnReadData(U64 device_id, U8 * data,
+					U32 data_length, void * user_data)
+{
+	SaleaeSource * source = (SaleaeSource *) user_data;
+	source->deliver(data, data_length);
+}
+
+void __stdcall SaleaeSource::OnError(U64 device_id, void * user_data)
+{
+	SaleaeSource * source = (SaleaeSource *) user_data;
+	source->fail();
+}
@@ -0,0 +1,56 @@
+#ifndef SALEAESOURCE_HPP_
+#define SALEAESOURCE_HPP_
+
+#include <vector>
+#include <mutex>
+#include <SaleaeDeviceApi.h>
+#include "capturesource.hpp"
+
+/* Capture source backed by a Saleae Logic analyzer through the SDK. */
+class SaleaeSource : public CaptureSource
+{
+public:
+	/* Start looking for devices; connected ones show up in devices(). */
+	static void beginConnect();
+	static std::vector<SaleaeSource *> devices();
+	/*
+	 * Returns as soon as count devices are connected or on timeout.
+	 * Devices that are new after that are ignored, known ones can
+	 * still reconnect.
+	 */
+	static std::vector<SaleaeSource *> waitForDevices(size_t count,
+							  double seconds);
+
+	~SaleaeSource();
+
+	void start();
+	void stop();
+	bool streaming() const;
+	unsigned sampleRate() const;
+	void sampleRate(unsigned rate);
+	std::vector<unsigned> supportedSampleRates();
+	void release(unsigned char * data);
+	const char * name() const;
+	bool connected() const;
+
+private:
+	SaleaeSource(U64 id, LogicInterface * device);
+	void attach(LogicInterface * device);
+
+	static void __stdcall OnConnect(U64 device_id,
+					GenericInterface * device_interface,
+					void * user_data);
+	static void __stdcall OnDisconnect(U64 device_id, void * user_data);
+	static void __stdcall OnReadData(U64 device_id, U8 * data,
+					 U32 data_length, void * user_data);
+	static void __stdcall OnError(U64 device_id, void * user_data);
+
+	static std::vector<SaleaeSource *> sources_;
+	static std::mutex sources_mutex_;
+	/* New devices are taken until waitForDevices() returns */
+	static bool accepting_;
+
+	LogicInterface * device_;
+	unsigned rate_;
+};
+#endif
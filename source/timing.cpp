@@ -0,0 +1,167 @@
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include "timing.hpp"
+
+#define TIMING_MAGIC "I2ST"
+#define TIMING_VERSION 1
+#define TIMING_RECORD_SIZE 8
+/* Enough for a 48 kHz frame sync at 100 MHz */
+#define FS_BINS 4096
+#define BIT_BINS 256
+
+Histogram::Histogram(unsigned bins)
+	:bins_(bins), count_(0), mean_(0), m2_(0), min_(0), max_(0)
+{
+}
+
+void Histogram::add(unsigned value)
+{
+	bins_[value < bins_.size() ? value : bins_.size() - 1]++;
+	if(!count_ || value < min_)
+		min_ = value;
+	if(value > max_)
+		max_ = value;
+	/* Welford, the bins alone would clip the outliers */
+	count_++;
+	double delta = value - mean_;
+	mean_ += delta / count_;
+	m2_ += delta * (value - mean_);
+}
+
+unsigned long long Histogram::count() const
+{
+	return count_;
+}
+
+double Histogram::mean() const
+{
+	return mean_;
+}
+
+double Histogram::stddev() const
+{
+	return count_ > 1 ? sqrt(m2_ / (count_ - 1)) : 0;
+}
+
+unsigned Histogram::min() const
+{
+	return min_;
+}
+
+unsigned Histogram::max() const
+{
+	return max_;
+}
+
+unsigned Histogram::percentile(double fraction) const
+{
+	unsigned long long wanted = (unsigned long long) (fraction * count_);
+	unsigned long long seen = 0;
+	for (size_t i = 0; i < bins_.size(); i++) {
+		seen += bins_[i];
+		if(seen > wanted)
+			return (unsigned) i;
+	}
+	return max_;
+}
+
+static void put2(unsigned char * p, unsigned value)
+{
+	if(value > 0xffff)
+		value = 0xffff;
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+}
+
+static void put4(unsigned char * p, unsigned value)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (value >> (8 * i)) & 0xff;
+}
+
+TimingAnalyzer::TimingAnalyzer(unsigned rate)
+	:rate_(rate), track_(NULL), fs_period_(FS_BINS), bit_min_(BIT_BINS),
+	 bit_max_(BIT_BINS), phase_(BIT_BINS), bit_period_sum_(0),
+	 bit_period_count_(0)
+{
+}
+
+TimingAnalyzer::~TimingAnalyzer()
+{
+	if(track_)
+		fclose(track_);
+}
+
+void TimingAnalyzer::track(const string & fileName)
+{
+	track_ = fopen(fileName.c_str(), "wb");
+	if(!track_){
+		fprintf(stderr, "Error opening filename: %s.\n",
+			fileName.c_str());
+		exit(1);
+	}
+	unsigned char header[16];
+	memcpy(header, TIMING_MAGIC, 4);
+	put4(header + 4, TIMING_VERSION);
+	put4(header + 8, rate_);
+	put4(header + 12, TIMING_RECORD_SIZE);
+	fwrite(header, sizeof(header), 1, track_);
+}
+
+void TimingAnalyzer::add(const FrameTiming & timing)
+{
+	/* The first frame after a resync has no period */
+	if(timing.fs_period) {
+		fs_period_.add(timing.fs_period);
+		bit_min_.add(timing.bit_min);
+		bit_max_.add(timing.bit_max);
+		phase_.add(timing.phase);
+		bit_period_sum_ += timing.bit_period;
+		bit_period_count_++;
+	}
+
+	if(track_) {
+		/*
+		 * FS period, mean bit period in 1/256 samples, shortest and
+		 * longest bit period, phase; 16 bit fields saturate.
+		 */
+		unsigned char r[TIMING_RECORD_SIZE];
+		put2(r, timing.fs_period);
+		put2(r + 2, (unsigned) (timing.bit_period * 256 + 0.5));
+		r[4] = timing.bit_min < 0xff ? timing.bit_min : 0xff;
+		r[5] = timing.bit_max < 0xff ? timing.bit_max : 0xff;
+		put2(r + 6, timing.phase);
+		fwrite(r, sizeof(r), 1, track_);
+	}
+}
+
+const Histogram & TimingAnalyzer::fsPeriod() const
+{
+	return fs_period_;
+}
+
+const Histogram & TimingAnalyzer::bitMin() const
+{
+	return bit_min_;
+}
+
+const Histogram & TimingAnalyzer::bitMax() const
+{
+	return bit_max_;
+}
+
+const Histogram & TimingAnalyzer::phase() const
+{
+	return phase_;
+}
+
+double TimingAnalyzer::bitPeriod() const
+{
+	return bit_period_count_ ? bit_period_sum_ / bit_period_count_ : 0;
+}
+
+unsigned TimingAnalyzer::rate() const
+{
+	return rate_;
+}
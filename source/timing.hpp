@@ -0,0 +1,71 @@
+#ifndef TIMING_HPP_
+#define TIMING_HPP_
+
+#include <string>
+#include <cstdio>
+#include <vector>
+#include "decoder.hpp"
+
+using namespace std;
+
+/* Streaming histogram of whole logic sample counts. */
+class Histogram
+{
+public:
+	/* Values from bins - 1 on share the last bin */
+	Histogram(unsigned bins);
+
+	void add(unsigned value);
+
+	unsigned long long count() const;
+	double mean() const;
+	double stddev() const;
+	unsigned min() const;
+	unsigned max() const;
+	/* Smallest value with at least fraction of the counts below it */
+	unsigned percentile(double fraction) const;
+
+private:
+	vector<unsigned long long> bins_;
+	unsigned long long count_;
+	double mean_;
+	double m2_;
+	unsigned min_;
+	unsigned max_;
+};
+
+/*
+ * Frame sync and bit clock statistics of one decoder, in logic
+ * samples. Optionally writes every frame to a timing track:
+ * a 16 byte header ("I2ST", version, logic rate, record size) followed
+ * by an 8 byte little endian record per frame.
+ */
+class TimingAnalyzer
+{
+public:
+	TimingAnalyzer(unsigned rate);
+	~TimingAnalyzer();
+
+	/* Write the timing track to a file. */
+	void track(const string & fileName);
+	void add(const FrameTiming & timing);
+
+	const Histogram & fsPeriod() const;
+	const Histogram & bitMin() const;
+	const Histogram & bitMax() const;
+	const Histogram & phase() const;
+	/* Mean bit clock period over all frames */
+	double bitPeriod() const;
+	unsigned rate() const;
+
+private:
+	unsigned rate_;
+	FILE * track_;
+	Histogram fs_period_;
+	Histogram bit_min_;
+	Histogram bit_max_;
+	Histogram phase_;
+	double bit_period_sum_;
+	unsigned long long bit_period_count_;
+};
+#endif
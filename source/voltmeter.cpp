@@ -14,6 +14,7 @@ VoltMeter::VoltMeter(int channels, int threshold, double min, double max,
 	max_value_counter_ = new int [channels_];
 	marker_ = new char [nsteps_+1];
 	marker_[nsteps_] = '\0';
+	notes_ = new string [channels_];
 
 	for (int i=0;i<channels_;i++){
 		max_value_counter_[i] = max_value_counter_threshold_;
@@ -27,6 +28,12 @@ VoltMeter::~VoltMeter()
 	delete[] max_values_;
 	delete[] max_value_counter_;
 	delete[] marker_;
+	delete[] notes_;
+}
+
+void VoltMeter::note(int channel, const string & text)
+{
+	notes_[channel] = text;
 }
 
 int VoltMeter::bin(double value)
@@ -53,7 +60,7 @@ void VoltMeter::draw(int channel, double value, double max_value)
 	}
 	marker_[bin(max_value)] = 'X';
 	printf("%d.", channel);
-	printf("|%s| %.2f                                                    \n", marker_, value);
+	printf("|%s| %.2f %s                                                    \n", marker_, value, notes_[channel].c_str());
 }
 
 
@@ -14,6 +14,8 @@ public:
 	~VoltMeter();
 
 	void set(double tbl[]);
+	/* Text shown after the level of a channel */
+	void note(int channel, const string & text);
 
 private:
 	void draw(int channel, double v, double m);
@@ -27,5 +29,6 @@ private:
 	int * max_value_counter_;
 	char * marker_;
 	bool enable_graphics_;
+	string * notes_;
 };
 #endif
@@ -7,6 +7,17 @@
 #include "wavfile.hpp"
 
 #define ABSMAX(x,pos) ((fabs((float)(x))>(pos))?fabs((float)(x)):(pos))
+/* Frames unpacked at a time by the planar reads */
+#define WAV_BLOCK_FRAMES 16384
+#define WAV_AHEAD_BLOCKS 2
+/* Frames the SSE2 planar reads transpose at a time */
+#define WAV_TILE 4
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WAV_SSE2 1
+#endif
 
 void textCompare(const char ** p, const char * str)
 {
@@ -88,7 +99,9 @@ void setValue4(char ** p, int value, bool littleEndian = true)
 
 
 WavFile::WavFile(const string & fileName, const string & mode)
-	:mFileName(fileName), mMode(mode), n_samples(0), mLevels(NULL)
+	:mDirect(NULL), mFileName(fileName), mMode(mode), n_samples(0),
+	 mLevels(NULL), mPackedFrames(0), mPackedPos(0), mFileFrames(0),
+	 mReadAhead(false), mAheadRunning(false)
 {
 	mFid = fopen(mFileName.c_str(), mMode.c_str());
 	if(!mFid){
@@ -125,11 +138,25 @@ WavFile::WavFile(const string & fileName, const string & mode)
 
 WavFile::~WavFile()
 {
+	stop_ahead();
 	if(mLevels) {
 		delete [] mLevels;
 		mLevels = NULL;
 	}
 
+	if(mDirect) {
+		/* The header and cues are patched in with stdio */
+		mDirect->close();
+		delete mDirect;
+		mDirect = NULL;
+		mFid = fopen(mFileName.c_str(), "r+b");
+		if(!mFid || fseek(mFid, 0, SEEK_END)){
+			fprintf(stderr, "Error opening filename: %s.\n",
+				mFileName.c_str());
+			exit(1);
+		}
+	}
+
 	if(mFid) {
 		if(mMode[0] == 'r') {
 			// Read
@@ -140,6 +167,10 @@ WavFile::~WavFile()
 				mHeader.Subchunk2Size = datasize;
 			}
 			mHeader.ChunkSize = 36 + datasize;
+			if (!mCues.empty()){
+				write_cues();
+				mHeader.ChunkSize = ftell(mFid) - 8;
+			}
 			// Write
 			write_header(&mHeader);
 		}
@@ -244,6 +275,78 @@ void WavFile::write_header(struct WavHeader * header)
 }
 
 
+void WavFile::addGap(unsigned frame, unsigned length)
+{
+	Cue cue = { frame, length };
+	mCues.push_back(cue);
+}
+
+/*
+ * Gaps go after the data chunk as a "cue " chunk and a "LIST" "adtl"
+ * chunk holding the length of each gap (ltxt) and a label (labl).
+ */
+void WavFile::write_cues()
+{
+	static const char label[] = "gap";
+	size_t n = mCues.size();
+	size_t cue_size = 4 + 24 * n;
+	size_t ltxt_size = 20;
+	size_t labl_size = 4 + sizeof(label);
+	size_t list_size = 4 + n * (8 + ltxt_size + 8 + labl_size);
+	vector<char> table(1 + 8 + cue_size + 8 + list_size, 0);
+	char * p = &table[0];
+
+	// RIFF chunks are word aligned
+	if (mHeader.Subchunk2Size & 1)
+		p++;
+	else
+		table.pop_back();
+
+	memcpy(p, "cue ", 4);
+	p+=4;
+	setValue4(&p, cue_size);
+	setValue4(&p, n);
+	for (size_t i=0;i<n;i++){
+		setValue4(&p, i + 1);           // dwName
+		setValue4(&p, mCues[i].frame);  // dwPosition
+		memcpy(p, "data", 4);           // fccChunk
+		p+=4;
+		setValue4(&p, 0);               // dwChunkStart
+		setValue4(&p, 0);               // dwBlockStart
+		setValue4(&p, mCues[i].frame);  // dwSampleOffset
+	}
+
+	memcpy(p, "LIST", 4);
+	p+=4;
+	setValue4(&p, list_size);
+	memcpy(p, "adtl", 4);
+	p+=4;
+	for (size_t i=0;i<n;i++){
+		memcpy(p, "ltxt", 4);
+		p+=4;
+		setValue4(&p, ltxt_size);
+		setValue4(&p, i + 1);           // dwName
+		setValue4(&p, mCues[i].length); // dwSampleLength
+		memcpy(p, "gap ", 4);           // dwPurposeID
+		p+=4;
+		setValue4(&p, 0);               // Country, Language
+		setValue4(&p, 0);               // Dialect, CodePage
+
+		memcpy(p, "labl", 4);
+		p+=4;
+		setValue4(&p, labl_size);
+		setValue4(&p, i + 1);
+		memcpy(p, label, sizeof(label));
+		p+=sizeof(label);
+	}
+
+	if(fwrite(&table[0], sizeof(char), table.size(), mFid) !=
+	   table.size()) {
+		fprintf(stderr, "Error writing WAV cue chunk.\n");
+		exit(1);
+	}
+}
+
 void update_levels(float * mLevels,
 		   const void * buffer,
 		   int BitsPerSample,
@@ -303,23 +406,407 @@ void update_levels(float * mLevels,
     }
 }
 
-size_t WavFile::read(void * buffer, int nFrames)
+size_t WavFile::fetch(void * buffer, int nFrames)
 {
-	size_t ret = 0;
-	if(mFid) {
-		ret = fread(buffer, (mHeader.BitsPerSample / 8) *
-			    mHeader.NumChannels, nFrames, mFid);
-		update_levels(mLevels, buffer, mHeader.BitsPerSample, nFrames,
-			      mHeader.NumChannels);
+	if(!mFid)
+		return 0;
+	if(mHeader.Subchunk2Size > 0) {
+		// Do not read trailing chunks as audio
+		long left = mHeader.Subchunk2Size /
+			((mHeader.BitsPerSample / 8) * mHeader.NumChannels) -
+			mFileFrames;
+		if(nFrames > left)
+			nFrames = left > 0 ? left : 0;
 	}
+	size_t ret = fread(buffer, (mHeader.BitsPerSample / 8) *
+			   mHeader.NumChannels, nFrames, mFid);
+	mFileFrames += ret;
+	return ret;
+}
+
+size_t WavFile::read(void * buffer, int nFrames)
+{
+	/* Go on right after what the planar reads handed out */
+	stop_ahead();
+	sync_position();
+	size_t ret = fetch(buffer, nFrames);
+	update_levels(mLevels, buffer, mHeader.BitsPerSample, ret,
+		      mHeader.NumChannels);
 	n_samples += ret;
 	return ret;
 }
 
+/* Sign extended sample from the packed bytes */
+template <int BYTES> static inline int unpack(const unsigned char * s);
+
+/* 8 bit WAV data is unsigned */
+template <> inline int unpack<1>(const unsigned char * s)
+{
+	return (int) s[0] - 128;
+}
+
+template <> inline int unpack<2>(const unsigned char * s)
+{
+	return (short) (s[0] | s[1] << 8);
+}
+
+template <> inline int unpack<3>(const unsigned char * s)
+{
+	return (int) ((unsigned) s[0] << 8 | (unsigned) s[1] << 16 |
+		      (unsigned) s[2] << 24) >> 8;
+}
+
+template <> inline int unpack<4>(const unsigned char * s)
+{
+	return (int) ((unsigned) s[0] | (unsigned) s[1] << 8 |
+		      (unsigned) s[2] << 16 | (unsigned) s[3] << 24);
+}
+
+/* Integer planes keep the value, the scale is for float planes */
+static inline void put_sample(int * out, int value, float)
+{
+	*out = value;
+}
+
+static inline void put_sample(float * out, int value, float scale)
+{
+	*out = value * scale;
+}
+
+static inline void peak(int value, int & lo, int & hi)
+{
+	lo = value < lo ? value : lo;
+	hi = value > hi ? value : hi;
+}
+
+#ifdef WAV_SSE2
+static inline void put_samples(int * out, __m128i v, __m128)
+{
+	_mm_storeu_si128((__m128i *) out, v);
+}
+
+static inline void put_samples(float * out, __m128i v, __m128 scale)
+{
+	_mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+}
+
+/*
+ * Sign extended samples of 4 channels from the packed bytes. The loads
+ * take no more than the 4 samples, so they never pass the block end.
+ */
+template <int BYTES> static inline __m128i unpack4(const unsigned char * s);
+
+template <> inline __m128i unpack4<1>(const unsigned char * s)
+{
+	int word;
+	memcpy(&word, s, 4);
+	__m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero);
+	v = _mm_unpacklo_epi16(v, zero);
+	return _mm_sub_epi32(v, _mm_set1_epi32(128));
+}
+
+template <> inline __m128i unpack4<2>(const unsigned char * s)
+{
+	__m128i v = _mm_loadl_epi64((const __m128i *) s);
+	return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+}
+
+template <> inline __m128i unpack4<3>(const unsigned char * s)
+{
+	int word;
+	memcpy(&word, s + 8, 4);
+	__m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) s),
+				       _mm_cvtsi32_si128(word));
+	/* Bytes 0, 3, 6 and 9 on, then the top byte cleared by the shifts */
+	__m128i a = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+	__m128i b = _mm_unpacklo_epi32(_mm_srli_si128(v, 6),
+				       _mm_srli_si128(v, 9));
+	v = _mm_unpacklo_epi64(a, b);
+	return _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+}
+
+template <> inline __m128i unpack4<4>(const unsigned char * s)
+{
+	return _mm_loadu_si128((const __m128i *) s);
+}
+
+/* SSE2 has no 32 bit min and max, select on a compare */
+static inline __m128i select(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline void peaks(__m128i v, int * lo, int * hi)
+{
+	__m128i l = _mm_loadu_si128((const __m128i *) lo);
+	__m128i h = _mm_loadu_si128((const __m128i *) hi);
+	l = select(_mm_cmplt_epi32(v, l), v, l);
+	h = select(_mm_cmpgt_epi32(v, h), v, h);
+	_mm_storeu_si128((__m128i *) lo, l);
+	_mm_storeu_si128((__m128i *) hi, h);
+}
+#endif
+
+/*
+ * Interleaved to planar in one pass over the packed data. With SSE2 it
+ * goes WAV_TILE frames at a time: 4 channels of each frame are unpacked
+ * to a register, transposed to 4 frames of each channel and stored to 4
+ * planes. The peaks of the channels for the levels are kept in lo and
+ * hi, taken on the way.
+ */
+template <int BYTES, typename T>
+static void deinterleave(const unsigned char * in, T ** planes,
+			 size_t offset, int nFrames, int channels,
+			 float scale, int * lo, int * hi)
+{
+	size_t frame_size = (size_t) channels * BYTES;
+	int i = 0;
+#ifdef WAV_SSE2
+	__m128 scale4 = _mm_set1_ps(scale);
+	for (; i + WAV_TILE <= nFrames; i += WAV_TILE) {
+		const unsigned char * p = in + i * frame_size;
+		size_t at = offset + i;
+		int c = 0;
+		for (; c + 4 <= channels; c += 4) {
+			const unsigned char * s = p + c * BYTES;
+			__m128i r0 = unpack4<BYTES>(s);
+			__m128i r1 = unpack4<BYTES>(s + frame_size);
+			__m128i r2 = unpack4<BYTES>(s + 2 * frame_size);
+			__m128i r3 = unpack4<BYTES>(s + 3 * frame_size);
+			peaks(r0, lo + c, hi + c);
+			peaks(r1, lo + c, hi + c);
+			peaks(r2, lo + c, hi + c);
+			peaks(r3, lo + c, hi + c);
+			__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+			__m128i t1 = _mm_unpacklo_epi32(r2, r3);
+			__m128i t2 = _mm_unpackhi_epi32(r0, r1);
+			__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+			put_samples(planes[c] + at,
+				    _mm_unpacklo_epi64(t0, t1), scale4);
+			put_samples(planes[c + 1] + at,
+				    _mm_unpackhi_epi64(t0, t1), scale4);
+			put_samples(planes[c + 2] + at,
+				    _mm_unpacklo_epi64(t2, t3), scale4);
+			put_samples(planes[c + 3] + at,
+				    _mm_unpackhi_epi64(t2, t3), scale4);
+		}
+		for (; c < channels; c++) {
+			for (int k = 0; k < WAV_TILE; k++) {
+				int v = unpack<BYTES>(p + k * frame_size +
+						      c * BYTES);
+				put_sample(&planes[c][at + k], v, scale);
+				peak(v, lo[c], hi[c]);
+			}
+		}
+	}
+#endif
+	for (; i < nFrames; i++) {
+		const unsigned char * p = in + i * frame_size;
+		for (int c = 0; c < channels; c++) {
+			int v = unpack<BYTES>(p + c * BYTES);
+			put_sample(&planes[c][offset + i], v, scale);
+			peak(v, lo[c], hi[c]);
+		}
+	}
+}
+
+template <typename T>
+size_t WavFile::read_planar(T ** planes, int nFrames)
+{
+	int channels = mHeader.NumChannels;
+	int bytes = mHeader.BitsPerSample / 8;
+	size_t frame_size = (size_t) bytes * channels;
+	float scale = 1.0f / (float) (1ULL << (mHeader.BitsPerSample - 1));
+	vector<int> lo(channels, 0), hi(channels, 0);
+	size_t done = 0;
+	while(done < (size_t) nFrames) {
+		if(mPackedPos == mPackedFrames && !next_block())
+			break;
+		size_t n = mPackedFrames - mPackedPos;
+		if(n > nFrames - done)
+			n = nFrames - done;
+		const unsigned char * p = &mPacked[mPackedPos * frame_size];
+		switch(bytes) {
+		case 1:
+			deinterleave<1>(p, planes, done, (int) n, channels,
+					scale, &lo[0], &hi[0]);
+			break;
+		case 2:
+			deinterleave<2>(p, planes, done, (int) n, channels,
+					scale, &lo[0], &hi[0]);
+			break;
+		case 3:
+			deinterleave<3>(p, planes, done, (int) n, channels,
+					scale, &lo[0], &hi[0]);
+			break;
+		case 4:
+			deinterleave<4>(p, planes, done, (int) n, channels,
+					scale, &lo[0], &hi[0]);
+			break;
+		}
+		mPackedPos += n;
+		done += n;
+	}
+	if(mLevels) {
+		for (int c = 0; c < channels; c++) {
+			mLevels[c] = ABSMAX(lo[c], mLevels[c]);
+			mLevels[c] = ABSMAX(hi[c], mLevels[c]);
+		}
+	}
+	n_samples += done;
+	return done;
+}
+
+size_t WavFile::read(int ** planes, int nFrames)
+{
+	return read_planar(planes, nFrames);
+}
+
+size_t WavFile::read(float ** planes, int nFrames)
+{
+	return read_planar(planes, nFrames);
+}
+
+void WavFile::readAhead(bool enable)
+{
+	if(enable == mReadAhead)
+		return;
+	stop_ahead();
+	mReadAhead = enable;
+}
+
+/* Next block of packed data for the planar reads, false at the end */
+bool WavFile::next_block()
+{
+	size_t frame_size = (size_t) (mHeader.BitsPerSample / 8) *
+		mHeader.NumChannels;
+	mPackedPos = 0;
+	mPackedFrames = 0;
+	if(!mReadAhead) {
+		mPacked.resize(WAV_BLOCK_FRAMES * frame_size);
+		mPackedFrames = fetch(&mPacked[0], WAV_BLOCK_FRAMES);
+		return mPackedFrames > 0;
+	}
+
+	if(!mAheadRunning && mFid) {
+		mAheadRunning = true;
+		mAheadThread = thread(&WavFile::ahead, this);
+	}
+	std::unique_lock<std::mutex> lock(mAheadMutex);
+	while(mAheadBlocks.empty() && mAheadRunning)
+		mAheadCond.wait(lock);
+	if(mAheadBlocks.empty())
+		return false;
+	/* The empty block at the end stays for the next call */
+	if(!mAheadBlocks.front().frames)
+		return false;
+	mPacked.swap(mAheadBlocks.front().data);
+	mPackedFrames = mAheadBlocks.front().frames;
+	mAheadBlocks.pop_front();
+	mAheadCond.notify_all();
+	return true;
+}
+
+void WavFile::ahead()
+{
+	size_t frame_size = (size_t) (mHeader.BitsPerSample / 8) *
+		mHeader.NumChannels;
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> lock(mAheadMutex);
+			while(mAheadRunning &&
+			      mAheadBlocks.size() >= WAV_AHEAD_BLOCKS)
+				mAheadCond.wait(lock);
+			if(!mAheadRunning)
+				break;
+		}
+		Packed block;
+		block.data.resize(WAV_BLOCK_FRAMES * frame_size);
+		block.frames = fetch(&block.data[0], WAV_BLOCK_FRAMES);
+		std::lock_guard<std::mutex> lock(mAheadMutex);
+		bool end = block.frames == 0;
+		mAheadBlocks.push_back(Packed());
+		mAheadBlocks.back().data.swap(block.data);
+		mAheadBlocks.back().frames = block.frames;
+		mAheadCond.notify_all();
+		if(end)
+			break;
+	}
+}
+
+void WavFile::stop_ahead()
+{
+	{
+		std::lock_guard<std::mutex> lock(mAheadMutex);
+		mAheadRunning = false;
+	}
+	mAheadCond.notify_all();
+	if(mAheadThread.joinable())
+		mAheadThread.join();
+	mAheadBlocks.clear();
+}
+
+/* Drop the data read ahead, the file continues after n_samples */
+void WavFile::sync_position()
+{
+	mPackedPos = 0;
+	mPackedFrames = 0;
+	if(!mFid || mFileFrames == n_samples)
+		return;
+	if(fsetpos(mFid, &fDataPos)) {
+		fprintf(stderr, "fsetpos() returned error.\n");
+		exit(1);
+	}
+	/* In steps, long is 32 bits on Windows */
+	unsigned long long left = (unsigned long long) n_samples *
+		(mHeader.BitsPerSample / 8) * mHeader.NumChannels;
+	while(left) {
+		long step = left > (1UL << 30) ? (1L << 30) : (long) left;
+		if(fseek(mFid, step, SEEK_CUR)) {
+			fprintf(stderr, "fseek() failed.\n");
+			exit(1);
+		}
+		left -= step;
+	}
+	mFileFrames = n_samples;
+}
+
+void WavFile::directIo()
+{
+	if(mMode[0] == 'r' || mDirect)
+		return;
+	fclose(mFid);
+	mFid = NULL;
+	mDirect = new DirectWriter(mFileName);
+	/* Room for the header, written at close */
+	char header[WAV_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	mDirect->write(header, sizeof(header));
+}
+
+void WavFile::schedule(int cpu, int priority)
+{
+	/* Only direct I/O has a writer thread */
+	if(mDirect)
+		mDirect->schedule(cpu, priority);
+}
+
+DirectWriter * WavFile::directWriter() const
+{
+	return mDirect;
+}
+
 size_t WavFile::write(const void * buffer, int nFrames)
 {
 	size_t ret = 0;
-	if(mFid) {
+	if(mDirect) {
+		size_t size = (mHeader.BitsPerSample / 8) *
+			mHeader.NumChannels;
+		ret = mDirect->write(buffer, size * nFrames) / size;
+		update_levels(mLevels, buffer, mHeader.BitsPerSample, nFrames,
+			      mHeader.NumChannels);
+	} else if(mFid) {
 		ret = fwrite(buffer, (mHeader.BitsPerSample / 8) *
 			     mHeader.NumChannels, nFrames, mFid);
 		update_levels(mLevels, buffer, mHeader.BitsPerSample, nFrames,
@@ -333,7 +820,7 @@ size_t WavFile::write(const void * buffer, int nFrames)
 bool WavFile::closed() const
 {
 	bool ret = true;
-	if(mFid)
+	if(mFid || mDirect)
 		ret = false;
 
 	return ret;
@@ -346,6 +833,10 @@ bool WavFile::eof() const
 
 void WavFile::rewind()
 {
+	stop_ahead();
+	mPackedPos = 0;
+	mPackedFrames = 0;
+	mFileFrames = 0;
 	if(fsetpos(mFid, &fDataPos)) {
 		fprintf(stderr, "fsetpos() returned error.\n");
 		exit(1);
@@ -358,6 +849,8 @@ void WavFile::byteRate()
 	mHeader.ByteRate =
 		mHeader.SampleRate * mHeader.NumChannels *
 		mHeader.BitsPerSample / 8;
+	mHeader.BlockAlign =
+		mHeader.NumChannels * mHeader.BitsPerSample / 8;
 }
 
 int WavFile::sampleRate() const
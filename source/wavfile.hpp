@@ -3,16 +3,31 @@
 
 #include <string>
 #include <cstdio>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "audiofile.hpp"
+#include "directwriter.hpp"
 
 using namespace std;
 
-class WavFile
+class WavFile : public AudioFile
 {
 public:
 	WavFile(const string & fileName, const string & mode);
 	~WavFile();
 
 	size_t read(void * buffer, int Nframes);
+	/*
+	 * Read into one plane per channel. Ints hold the sign extended
+	 * samples, floats are scaled to [-1, 1).
+	 */
+	size_t read(int ** planes, int Nframes);
+	size_t read(float ** planes, int Nframes);
+	/* Read ahead from a thread while the planes are unpacked. */
+	void readAhead(bool enable);
 	size_t write(const void * buffer, int Nframes);
 
 	int sampleRate() const;
@@ -30,9 +45,16 @@ public:
 	bool eof() const;
 	float level_db(int ch_id);
 	void level_db(double * db);
+	/* Mark length missing frames at frame, stored as a cue point. */
+	void addGap(unsigned frame, unsigned length);
+	/* Write the data past the page cache, call before write(). */
+	void directIo();
+	DirectWriter * directWriter() const;
+	void schedule(int cpu, int priority);
 
 private:
 	FILE * mFid;
+	DirectWriter * mDirect;
 	const string mFileName;
 	const string mMode;
 	unsigned n_samples;
@@ -50,11 +72,43 @@ private:
 		int Subchunk2Size;
 	};
 
+	struct Cue {
+		unsigned frame;
+		unsigned length;
+	};
+
 	float * mLevels;
 	struct WavHeader mHeader;
 	fpos_t fDataPos;
+	vector<Cue> mCues;
 
 	void byteRate();
+	void write_cues();
+
+	size_t fetch(void * buffer, int nFrames);
+	template <typename T> size_t read_planar(T ** planes, int nFrames);
+	bool next_block();
+	void ahead();
+	void stop_ahead();
+	void sync_position();
+
+	/* Packed data read ahead of the planar reads */
+	vector<unsigned char> mPacked;
+	size_t mPackedFrames;
+	size_t mPackedPos;
+	/* Frames read from the file, n_samples counts those handed out */
+	unsigned long mFileFrames;
+
+	struct Packed {
+		vector<unsigned char> data;
+		size_t frames;
+	};
+	bool mReadAhead;
+	bool mAheadRunning;
+	thread mAheadThread;
+	mutex mAheadMutex;
+	condition_variable mAheadCond;
+	deque<Packed> mAheadBlocks;
 
 	void read_header(struct WavHeader * header);
 	void write_header(struct WavHeader * header);
@@ -0,0 +1,138 @@
+/*
+ * Times the planar reads of a 34 MB 8 channel 24 bit WAV against a
+ * packed read() with a naive unpack after it, and checks that both
+ * give the same samples.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include "wavfile.hpp"
+
+#define FILE_NAME "tests/bin/bench.wav"
+#define CHANNELS 8
+#define BYTES 3
+#define FRAMES (34 * 1000 * 1000 / (CHANNELS * BYTES))
+#define CHUNK 4096
+#define RUNS 5
+
+typedef std::chrono::steady_clock Clock;
+
+static void write_file()
+{
+	WavFile wav(FILE_NAME, "wb");
+	wav.sampleRate(48000);
+	wav.channelCount(CHANNELS);
+	wav.bitsPerSample(BYTES * 8);
+	std::vector<unsigned char> block(CHUNK * CHANNELS * BYTES);
+	unsigned seed = 1;
+	for (int done = 0; done < FRAMES; done += CHUNK) {
+		int n = FRAMES - done < CHUNK ? FRAMES - done : CHUNK;
+		for (size_t i = 0; i < (size_t) n * CHANNELS * BYTES; i++) {
+			seed = seed * 1103515245 + 12345;
+			block[i] = (unsigned char) (seed >> 16);
+		}
+		wav.write(&block[0], n);
+	}
+}
+
+/* Keeps the unpacked samples from being optimized away */
+static volatile float sink;
+
+/* The unpack the analysis did after read() before the planar reads */
+static void naive_unpack(const unsigned char * block, float ** planes,
+			 size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		for (int c = 0; c < CHANNELS; c++) {
+			const unsigned char * s =
+				&block[(i * CHANNELS + c) * BYTES];
+			int v = (int) ((unsigned) s[0] << 8 |
+				       (unsigned) s[1] << 16 |
+				       (unsigned) s[2] << 24) >> 8;
+			planes[c][i] = v / 8388608.0f;
+		}
+	}
+}
+
+struct Planes {
+	std::vector<float> data;
+	float * planes[CHANNELS];
+
+	Planes() : data(CHANNELS * CHUNK)
+	{
+		for (int c = 0; c < CHANNELS; c++)
+			planes[c] = &data[c * CHUNK];
+	}
+};
+
+static double packed()
+{
+	WavFile wav(FILE_NAME, "rb");
+	std::vector<unsigned char> block(CHUNK * CHANNELS * BYTES);
+	Planes out;
+	Clock::time_point start = Clock::now();
+	size_t n;
+	while((n = wav.read(&block[0], CHUNK)) > 0) {
+		naive_unpack(&block[0], out.planes, n);
+		sink = out.planes[CHANNELS - 1][n - 1];
+	}
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double planar(bool ahead)
+{
+	WavFile wav(FILE_NAME, "rb");
+	wav.readAhead(ahead);
+	Planes out;
+	Clock::time_point start = Clock::now();
+	size_t n;
+	while((n = wav.read(out.planes, CHUNK)) > 0)
+		sink = out.planes[CHANNELS - 1][n - 1];
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/* The planar reads against the naive unpack, untimed */
+static bool same(bool ahead)
+{
+	WavFile a(FILE_NAME, "rb");
+	WavFile b(FILE_NAME, "rb");
+	b.readAhead(ahead);
+	std::vector<unsigned char> block(CHUNK * CHANNELS * BYTES);
+	Planes pa, pb;
+	size_t total = 0, n;
+	while((n = a.read(&block[0], CHUNK)) > 0) {
+		naive_unpack(&block[0], pa.planes, n);
+		if(b.read(pb.planes, CHUNK) != n)
+			return false;
+		for (int c = 0; c < CHANNELS; c++)
+			if(memcmp(pa.planes[c], pb.planes[c], n * sizeof(float)))
+				return false;
+		total += n;
+	}
+	return total == FRAMES;
+}
+
+int main()
+{
+	write_file();
+	bool ok = same(false) && same(true);
+	double best[3] = { 1e9, 1e9, 1e9 };
+	/* The file stays in the page cache, so this times the unpacking */
+	for (int run = 0; run < RUNS; run++) {
+		double t[3] = { packed(), planar(false), planar(true) };
+		for (int i = 0; i < 3; i++)
+			best[i] = t[i] < best[i] ? t[i] : best[i];
+	}
+	remove(FILE_NAME);
+
+	printf("%-28s%.4f s\n", "read() and naive unpack", best[0]);
+	printf("%-28s%.4f s  %.2fx\n", "read(float **)", best[1],
+	       best[0] / best[1]);
+	printf("%-28s%.4f s  %.2fx\n", "read(float **), read ahead", best[2],
+	       best[0] / best[2]);
+	if(!ok)
+		printf("FAIL: the planar reads differ from the packed read\n");
+	return ok ? 0 : 1;
+}
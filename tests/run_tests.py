@@ -0,0 +1,35 @@
+import os, sys, platform
+
+# Builds and runs the tests in this folder against the sources they need.
+# They do not use the Saleae SDK, so they build for the host as it is,
+# with the large file support of build_project.py.
+# usage: python tests/run_tests.py [test_name ...]
+
+tests = {
+    "bench_wav_read": [ "wavfile.cpp", "directwriter.cpp", "affinity.cpp" ],
+    "test_analyzer": [ "analyzer.cpp", "fft.cpp" ],
+    "test_replay_seek": [ "replaysource.cpp", "capturesource.cpp" ],
+}
+
+compile_flags = "-D_FILE_OFFSET_BITS=64 -D_LARGEFILE_SOURCE -std=c++11 -pthread -O2"
+
+root = os.path.dirname( os.path.dirname( os.path.realpath( __file__ ) ) )
+os.chdir( root )
+if not os.path.exists( "tests/bin" ):
+    os.makedirs( "tests/bin" )
+
+names = sys.argv[1:] or sorted( tests.keys() )
+failed = []
+for name in names:
+    command = "g++ " + compile_flags + " -I\"source\" -o\"tests/bin/" + name + "\" "
+    command += "\"tests/" + name + ".cpp\""
+    for cpp_file in tests[name]:
+        command += " \"source/" + cpp_file + "\""
+    print( command )
+    if os.system( command ) != 0 or os.system( os.path.join( "tests", "bin", name ) ) != 0:
+        failed.append( name )
+
+print( "%d of %d tests passed" % ( len( names ) - len( failed ), len( names ) ) )
+if failed:
+    print( "failed: " + " ".join( failed ) )
+    sys.exit( 1 )
@@ -0,0 +1,50 @@
+/*
+ * A clean 24 bit sine at -1 dBFS has to read close to the quantization
+ * limit, about -140 dB THD+N, wherever it falls between the FFT bins.
+ */
+#define _USE_MATH_DEFINES
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include "analyzer.hpp"
+
+#define RATE 48000
+#define FRAMES (4 * RATE)
+#define FFT_SIZE 8192
+
+static bool check(double hz, double limit_db)
+{
+	SpectrumAnalyzer analyzer(1, 24, RATE, FFT_SIZE);
+	analyzer.start();
+	double amplitude = pow(10.0, -1.0 / 20) * 8388607;
+	for (int i = 0; i < FRAMES; i++) {
+		int v = (int) lround(amplitude * sin(2 * M_PI * hz * i / RATE));
+		char frame[3] = { (char) v, (char) (v >> 8), (char) (v >> 16) };
+		analyzer.push(frame);
+		/* Let the analysis keep up, the ring drops when full */
+		if(i % 4096 == 4095)
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	analyzer.stop();
+
+	ChannelAnalysis a = analyzer.results()[0];
+	bool ok = fabs(a.fundamental - hz) < 0.5 && fabs(a.level + 1) < 0.1 &&
+		a.thdn < limit_db;
+	printf("%s %8.1f Hz: %8.2f Hz %6.2f dBFS THD+N %7.2f dB "
+	       "(limit %.0f)\n", ok ? "ok  " : "FAIL", hz, a.fundamental,
+	       a.level, a.thdn, limit_db);
+	return ok;
+}
+
+int main()
+{
+	/* On a bin, between bins and the usual test tones */
+	static const double tones[] = { 6000, 1000, 997, 3001.3, 100, 15000 };
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(tones) / sizeof(tones[0]); i++)
+		failed += !check(tones[i], -135);
+	return failed ? 1 : 0;
+}
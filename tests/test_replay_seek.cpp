@@ -0,0 +1,86 @@
+/*
+ * Replays have to reach index offsets above 2 and 4 GiB. The dump is a
+ * sparse file with a pattern at those offsets.
+ */
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "replaysource.hpp"
+
+#define TEST_FILE "tests/bin/large.bin"
+#define PATTERN 4096
+
+struct Received {
+	std::vector<unsigned char> data;
+	std::atomic<bool> done;
+};
+
+static void OnData(CaptureSource * source, unsigned char * data,
+		   unsigned length, void * user_data)
+{
+	Received * r = (Received *) user_data;
+	if(!r->done) {
+		r->data.assign(data, data + length);
+		r->done = true;
+	}
+	source->release(data);
+}
+
+static unsigned char pattern(unsigned long long offset, int i)
+{
+	return (unsigned char) (offset * 7 + i * 13);
+}
+
+static bool write_pattern(FILE * f, unsigned long long offset)
+{
+	unsigned char p[PATTERN];
+	for (int i = 0; i < PATTERN; i++)
+		p[i] = pattern(offset, i);
+	return fseeko(f, (off_t) offset, SEEK_SET) == 0 &&
+		fwrite(p, 1, PATTERN, f) == PATTERN;
+}
+
+int main()
+{
+	static const unsigned long long offsets[] = {
+		0, (1ULL << 31) + 12345, (1ULL << 32) + 7
+	};
+	int count = sizeof(offsets) / sizeof(offsets[0]);
+
+	FILE * f = fopen(TEST_FILE, "wb");
+	for (int i = 0; i < count; i++) {
+		if(!f || !write_pattern(f, offsets[i])) {
+			printf("FAIL could not write %s at %llu\n", TEST_FILE,
+			       offsets[i]);
+			return 1;
+		}
+	}
+	fclose(f);
+
+	int failed = 0;
+	for (int i = 0; i < count; i++) {
+		ReplaySource replay(TEST_FILE);
+		replay.realtime(false);
+		replay.seek(offsets[i]);
+		Received r;
+		r.done = false;
+		replay.registerOnData(&OnData, &r);
+		replay.start();
+		while(!r.done && !replay.exhausted())
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(1));
+		replay.stop();
+
+		bool ok = r.data.size() >= PATTERN;
+		for (int k = 0; ok && k < PATTERN; k++)
+			ok = r.data[k] == pattern(offsets[i], k);
+		printf("%s replay from %llu\n", ok ? "ok  " : "FAIL",
+		       offsets[i]);
+		failed += !ok;
+	}
+	remove(TEST_FILE);
+	return failed ? 1 : 0;
+}